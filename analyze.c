@@ -0,0 +1,283 @@
+#include "block.c"
+#include "bwt.c"
+#include "code.c"
+#include "defines.h"
+#include "header.h"
+#include "huffman.c"
+#include "index.c"
+#include "io.c"
+#include "kernel.c"
+#include "node.c"
+#include "place.c"
+#include "pq.c"
+#include "stack.c"
+#include "table.c"
+#include "tans.c"
+#include "wide.c"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h> // only use for printf, else use io.c
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define OPTIONS     "hbt:i:"
+#define MIN_BLOCK   (64 * 1024) // Smallest block size predicted.
+#define BLOCK_MODES 5 // 64KB, 128KB, 256KB, 512KB and 1MB blocks.
+
+void print_help(char *path);
+int check_open(int fd, char *filename);
+
+// Histograms of a run of MIN_BLOCK blocks, counted by one thread
+typedef struct Slice {
+    const uint8_t *data;
+    uint64_t size;
+    uint64_t first; // First block index.
+    uint64_t last; // One past the last block index.
+    uint64_t (*hists)[ALPHABET];
+} Slice;
+
+static void *count_slice(void *arg) {
+    Slice *s = (Slice *) arg;
+    for (uint64_t b = s->first; b < s->last; b++) {
+        uint64_t start = b * MIN_BLOCK;
+        uint64_t len = s->size - start < MIN_BLOCK ? s->size - start : MIN_BLOCK;
+        memset(s->hists[b], 0, sizeof(s->hists[b]));
+        kernel.hist(&s->data[start], len, s->hists[b]);
+    }
+    return NULL;
+}
+
+// Shannon entropy in bits per byte, as in entropy.c
+static double entropy(uint64_t hist[static ALPHABET], uint64_t n) {
+    double sum = 0.0;
+    for (int i = 0; i < ALPHABET; i++) {
+        if (hist[i]) {
+            double p = (double) hist[i] / (double) n;
+            sum += p * log2(p);
+        }
+    }
+    return n ? -sum : 0.0;
+}
+
+int main(int argc, char **argv) {
+    uint32_t threads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool per_block = false;
+    int infile = STDIN_FILENO;
+
+    int opt;
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'h': print_help(argv[0]); return EXIT_SUCCESS;
+        case 'b': per_block = true; break;
+        case 't': threads = strtoul(optarg, NULL, 10); break;
+        case 'i':
+            infile = open(optarg, O_RDONLY);
+            if (check_open(infile, optarg)) {
+                return EXIT_FAILURE;
+            }
+            break;
+        default: print_help(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    kernel_select("auto");
+    threads = threads ? threads : 1;
+
+    // Map the input, or read it all if it cannot be mapped
+    struct stat statbuf;
+    fstat(infile, &statbuf);
+    uint64_t size = statbuf.st_size;
+    uint8_t *data = NULL;
+    bool mapped = false;
+    if (S_ISREG(statbuf.st_mode) && size) {
+        data = (uint8_t *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, infile, 0);
+        mapped = data != MAP_FAILED;
+        if (mapped) {
+            madvise(data, size, MADV_SEQUENTIAL);
+        }
+    }
+    if (!mapped) {
+        uint64_t cap = BLOCK;
+        size = 0;
+        data = (uint8_t *) malloc(cap);
+        int num_read = 0;
+        // read_bytes() takes an int, so each read is clamped to INT_MAX
+        while (data && (num_read = read_bytes(infile, &data[size], cap - size < INT_MAX ? cap - size : INT_MAX)) != 0) {
+            size += num_read;
+            if (size == cap) {
+                uint8_t *grown = (uint8_t *) realloc(data, 2 * cap);
+                if (!grown) {
+                    free(data);
+                }
+                data = grown;
+                cap *= 2;
+            }
+        }
+        if (!data) {
+            fprintf(stderr, "Error: not enough memory to buffer the input\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Per-block histograms in parallel, everything else is derived from them
+    uint64_t nblocks = (size + MIN_BLOCK - 1) / MIN_BLOCK;
+    uint64_t(*hists)[ALPHABET] = calloc(nblocks + 1, sizeof(*hists));
+    threads = nblocks < threads ? (nblocks ? nblocks : 1) : threads;
+    pthread_t *workers = (pthread_t *) calloc(threads, sizeof(pthread_t));
+    Slice *slices = (Slice *) calloc(threads, sizeof(Slice));
+    bool *started = (bool *) calloc(threads, sizeof(bool));
+    if (!hists || !workers || !slices || !started) {
+        fprintf(stderr, "Error: not enough memory for the histograms\n");
+        return EXIT_FAILURE;
+    }
+    // A slice whose thread cannot be started is counted here instead
+    for (uint32_t t = 0; t < threads; t++) {
+        slices[t] = (Slice) { data, size, nblocks * t / threads, nblocks * (t + 1) / threads, hists };
+        started[t] = !pthread_create(&workers[t], NULL, count_slice, &slices[t]);
+        if (!started[t]) {
+            count_slice(&slices[t]);
+        }
+    }
+    for (uint32_t t = 0; t < threads; t++) {
+        if (started[t]) {
+            pthread_join(workers[t], NULL);
+        }
+    }
+    free(workers);
+    free(slices);
+    free(started);
+
+    uint64_t global[ALPHABET] = { 0 };
+    for (uint64_t b = 0; b < nblocks; b++) {
+        for (int i = 0; i < ALPHABET; i++) {
+            global[i] += hists[b][i];
+        }
+    }
+
+    // Single tree: header, tree dump and codes, flush_codes() pads a byte
+    uint64_t hist[ALPHABET];
+    prep_hist(hist);
+    for (int i = 0; i < ALPHABET; i++) {
+        hist[i] += global[i];
+    }
+    Node *root = build_tree(hist);
+    Code table[ALPHABET] = { { 0 } };
+    build_codes(root, table);
+    delete_tree(&root);
+    uint64_t bits = 0;
+    uint64_t tree_size = 0;
+    for (int i = 0; i < ALPHABET; i++) {
+        if (hist[i]) {
+            bits += global[i] * code_size(&table[i]);
+            tree_size += 3;
+        }
+    }
+    tree_size--;
+    uint64_t single = sizeof(Header) + tree_size + bits / 8 + 1;
+
+    printf("{\n");
+    printf("  \"size\": %" PRIu64 ",\n", size);
+    printf("  \"threads\": %" PRIu32 ",\n", threads);
+    printf("  \"entropy\": %.6f,\n", entropy(global, size));
+    printf("  \"entropy_bytes\": %.0f,\n", ceil(entropy(global, size) * size / 8.0));
+    printf("  \"huffman_bits\": %" PRIu64 ",\n", bits);
+    printf("  \"modes\": [\n");
+    printf("    { \"mode\": \"single\", \"header\": %" PRIu64 ", \"size\": %" PRIu64 " },\n",
+        sizeof(Header) + tree_size, single);
+
+    // Block format at each size, blocks of fixed size with a fresh tree or stored
+    const char *best = "single";
+    uint64_t best_size = single;
+    static char names[BLOCK_MODES][32];
+    for (int m = 0; m < BLOCK_MODES; m++) {
+        uint64_t span = (uint64_t) 1 << m; // MIN_BLOCKs per block
+        // Header, end block and the trailing index: an entry per block and the trailer
+        uint64_t count = (nblocks + span - 1) / span;
+        uint64_t total = sizeof(Header) + sizeof(BlockHeader) + count * sizeof(IndexEntry) + sizeof(IndexTrailer);
+        uint64_t header = total;
+        for (uint64_t b = 0; b < nblocks; b += span) {
+            uint64_t merged[ALPHABET] = { 0 };
+            uint64_t end = b + span < nblocks ? b + span : nblocks;
+            for (uint64_t k = b; k < end; k++) {
+                for (int i = 0; i < ALPHABET; i++) {
+                    merged[i] += hists[k][i];
+                }
+            }
+            uint64_t len = (end * MIN_BLOCK < size ? end * MIN_BLOCK : size) - b * MIN_BLOCK;
+            total += predict_block(merged, len, &header);
+        }
+        snprintf(names[m], sizeof(names[m]), "blocks-%" PRIu64, span * MIN_BLOCK);
+        printf("    { \"mode\": \"%s\", \"block_size\": %" PRIu64 ", \"header\": %" PRIu64
+               ", \"size\": %" PRIu64 " },\n",
+            names[m], span * MIN_BLOCK, header, total);
+        if (total < best_size) {
+            best = names[m];
+            best_size = total;
+        }
+    }
+    uint64_t max_blocks = (size + MAX_BLOCK - 1) / MAX_BLOCK;
+    uint64_t stored = sizeof(Header) + (max_blocks + 1) * sizeof(BlockHeader) + max_blocks * sizeof(IndexEntry)
+                      + sizeof(IndexTrailer) + size;
+    printf("    { \"mode\": \"stored\", \"header\": %" PRIu64 ", \"size\": %" PRIu64 " }\n",
+        stored - size, stored);
+    printf("  ],\n");
+    printf("  \"best\": \"%s\",\n", best_size < stored ? best : "stored");
+    printf("  \"compress\": %s", best_size < size ? "true" : "false");
+
+    if (per_block) {
+        printf(",\n  \"blocks\": [\n");
+        for (uint64_t b = 0; b < nblocks; b++) {
+            uint64_t len = size - b * MIN_BLOCK < MIN_BLOCK ? size - b * MIN_BLOCK : MIN_BLOCK;
+            printf("    { \"offset\": %" PRIu64 ", \"entropy\": %.6f }%s\n", b * MIN_BLOCK,
+                entropy(hists[b], len), b + 1 < nblocks ? "," : "");
+        }
+        printf("  ]");
+    }
+    printf("\n}\n");
+
+    free(hists);
+    if (mapped) {
+        munmap(data, size);
+    } else {
+        free(data);
+    }
+    close(infile);
+    return EXIT_SUCCESS;
+}
+
+void print_help(char *path) {
+    printf("SYNOPSIS\n");
+    printf("  Predicts compressed sizes for each mode without encoding, as JSON.\n\n");
+    printf("USAGE\n");
+    printf("  %s [-h] [-b] [-t threads] [-i infile]\n\n", path);
+    printf("OPTIONS\n");
+    printf("  -%-14s Program usage and help.\n", "h");
+    printf("  -%-14s Include per-block entropy.\n", "b");
+    printf("  -%-14s Threads counting histograms (default: cores).\n", "t threads");
+    printf("  -%-14s Specify input file to analyze.\n", "i infile");
+}
+
+// returns non-zero if fd is an error code
+int check_open(int fd, char *filename) {
+    if (errno == EACCES) {
+        fprintf(stderr, "Error: File %s cannot be accessed.\n", filename);
+        return 1; // Error
+    } else if (errno == ENOENT) {
+        fprintf(stderr, "Error: File %s does not exist.\n", filename);
+        return 1;
+    } else if (fd < 0) {
+        fprintf(stderr, "Error: Could not open file %s\n", filename);
+        return 1;
+    }
+    return 0; // OK
+}
@@ -0,0 +1,514 @@
+#include "block.h"
+
+#include "bwt.h"
+#include "code.h"
+#include "defines.h"
+#include "huffman.h"
+#include "io.h"
+#include "kernel.h"
+#include "node.h"
+#include "place.h"
+#include "table.h"
+#include "tans.h"
+#include "wide.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SPLIT_STEP   (64 * 1024) // Distance between cut candidates at effort 1.
+#define MIN_STEP     256 // Smallest distance, reached at effort 9.
+#define SPLIT_WINDOW (16 * 1024) // Lookahead compared against each cut.
+#define REPEAT_SLACK 0.01 // Reuse a table costing up to 1% over a fresh one.
+#define FILTER_SAMPLE (64 * 1024) // Bytes of a block tried with each stride.
+#define FILTER_GAIN   0.97 // Filter only if the sample shrinks by 3% or more.
+
+// Estimated bits to code n bytes with hist, including the block header and
+// tree dump. Uses the same Shannon entropy as entropy.c:
+//  n*log2(n) - sum(c*log2(c))
+double block_cost(uint64_t hist[static ALPHABET], uint64_t n) {
+    if (!n) {
+        return 0.0;
+    }
+    double sum = 0.0;
+    uint32_t unique = 0;
+    for (int i = 0; i < ALPHABET; i++) {
+        if (hist[i]) {
+            sum += hist[i] * log2((double) hist[i]);
+            unique++;
+        }
+    }
+    double tree = 3.0 * (unique > 2 ? unique : 2) - 1;
+    return n * log2((double) n) - sum + 8.0 * (sizeof(BlockHeader) + tree);
+}
+
+// Returns the length of the next block to cut from buf. Scans buf in
+// segments, cutting where coding the next segment with a fresh table
+// (header included) is cheaper than extending the current block.
+// Effort 0 keeps fixed-size blocks, higher efforts scan finer segments.
+uint32_t block_split(const uint8_t *buf, uint32_t n, uint32_t effort) {
+    if (!effort) {
+        return n;
+    }
+    uint32_t step = SPLIT_STEP >> (effort - 1 < 16 ? effort - 1 : 16);
+    step = step < MIN_STEP ? MIN_STEP : step;
+    if (n <= step) {
+        return n;
+    }
+
+    // Cut candidates every step bytes, each judged against a window of the
+    // following data so small steps are not swamped by table overhead
+    uint32_t window = step > SPLIT_WINDOW ? step : SPLIT_WINDOW;
+    uint64_t block[ALPHABET] = { 0 };
+    uint64_t merged[ALPHABET];
+    uint64_t next[ALPHABET];
+    kernel.hist(buf, step, block);
+    uint32_t len = step;
+    while (len < n) {
+        uint32_t next_len = n - len < window ? n - len : window;
+        memset(next, 0, sizeof(next));
+        kernel.hist(&buf[len], next_len, next);
+        for (int i = 0; i < ALPHABET; i++) {
+            merged[i] = block[i] + next[i];
+        }
+        double split = block_cost(block, len) + block_cost(next, next_len);
+        double joined = block_cost(merged, len + next_len);
+        if (split < joined) {
+            break; // Statistics changed enough to pay for a new table
+        }
+        uint32_t seg_len = n - len < step ? n - len : step;
+        kernel.hist(&buf[len], seg_len, block);
+        len += seg_len;
+    }
+    return len;
+}
+
+// Size in bytes, block header included, that encode_block() gives n bytes
+// with hist when it builds a fresh table. Adds the header and tree
+// bytes to *overhead.
+uint64_t predict_block(uint64_t hist[static ALPHABET], uint32_t n, uint64_t *overhead) {
+    uint64_t tree_hist[ALPHABET];
+    prep_hist(tree_hist);
+    for (int i = 0; i < ALPHABET; i++) {
+        tree_hist[i] += hist[i];
+    }
+    Node *root = build_tree(tree_hist);
+    Code table[ALPHABET] = { { 0 } };
+    build_codes(root, table);
+    delete_tree(&root);
+
+    uint64_t bits = 0;
+    uint32_t tree_size = 0;
+    for (int i = 0; i < ALPHABET; i++) {
+        if (tree_hist[i]) {
+            bits += hist[i] * code_size(&table[i]);
+            tree_size += 3;
+        }
+    }
+    tree_size--;
+
+    // Same choice as encode_block(), the tANS size is an estimate
+    uint16_t freq[ALPHABET];
+    uint8_t freqs[1 + 3 * ALPHABET];
+    tans_normalize(hist, n, freq);
+    uint32_t freqs_size = tans_write_table(freq, freqs);
+    double tans = tans_cost(hist, freq);
+    if (tans + 8.0 * freqs_size < bits + 8.0 * tree_size) {
+        tree_size = freqs_size;
+        bits = ceil(tans);
+    }
+    uint64_t coded = tree_size + (bits + 7) / 8;
+    *overhead += sizeof(BlockHeader) + (coded < n ? tree_size : 0);
+    return sizeof(BlockHeader) + (coded < n ? coded : n);
+}
+
+// What a block codes: the raw bytes, or their transform plus its header
+typedef struct Source {
+    const uint8_t *raw; // Original bytes, written as is for stored blocks.
+    uint32_t n;
+    const uint8_t *syms; // Symbols to code.
+    uint32_t count;
+    Transform *tf; // NULL when untransformed.
+    Filter *filter; // NULL when unfiltered.
+} Source;
+
+static void write_block(int outfile, BlockHeader *bh, Source *src, uint8_t *tree, uint8_t *payload) {
+    write_bytes(outfile, (uint8_t *) bh, sizeof(BlockHeader));
+    if (bh->flags & BLOCK_FILTER) {
+        write_bytes(outfile, (uint8_t *) src->filter, sizeof(Filter));
+    }
+    if (bh->flags & BLOCK_BWT) {
+        write_bytes(outfile, (uint8_t *) src->tf, sizeof(Transform));
+    }
+    write_bytes(outfile, tree, bh->tree_size);
+    write_bytes(outfile, payload, bh->payload_size);
+}
+
+// Writes the raw bytes if a coded block of payload_size would not be smaller
+static bool write_stored(int outfile, BlockHeader *bh, Source *src, uint32_t payload_size) {
+    if (block_extra(bh) + bh->tree_size + payload_size < src->n) {
+        return false;
+    }
+    bh->type = BLOCK_STORED;
+    bh->flags = 0;
+    bh->tree_size = 0;
+    bh->payload_size = src->n;
+    write_block(outfile, bh, src, NULL, (uint8_t *) src->raw);
+    return true;
+}
+
+// Writes the symbols coded with table, or stored. Returns false, writing
+// nothing, if the payload cannot be allocated.
+static bool write_coded(int outfile, BlockHeader *bh, Source *src, char *tree, Code *table, uint64_t bits) {
+    uint32_t payload_size = (bits + 7) / 8;
+    if (write_stored(outfile, bh, src, payload_size)) {
+        return true;
+    }
+    uint8_t *payload = (uint8_t *) calloc(payload_size + 8, 1);
+    if (!payload) {
+        return false;
+    }
+    kernel.encode(src->syms, src->count, table, payload, 0);
+    bh->payload_size = payload_size;
+    write_block(outfile, bh, src, (uint8_t *) tree, payload);
+    free(payload);
+    return true;
+}
+
+// Writes the symbols coded with tANS, or stored. Returns false, writing
+// nothing, if out of memory.
+static bool write_tans(int outfile, BlockHeader *bh, Source *src, uint8_t *freqs, uint16_t *freq) {
+    uint8_t *payload = (uint8_t *) calloc(((uint64_t) src->count * TANS_LOG + 2 * TANS_LOG) / 8 + 16, 1);
+    uint64_t bits = payload ? tans_encode(src->syms, src->count, freq, payload) : 0;
+    if (!bits) { // Even no symbols take the two initial states
+        free(payload);
+        return false;
+    }
+    uint32_t payload_size = (bits + 7) / 8;
+    if (!write_stored(outfile, bh, src, payload_size)) {
+        bh->payload_size = payload_size;
+        write_block(outfile, bh, src, freqs, payload);
+    }
+    free(payload);
+    return true;
+}
+
+// Code the source as one block. Reuses the previous block's table when
+// its cost is within REPEAT_SLACK of the estimate for a fresh one,
+// skipping the tree build and dump; otherwise builds a new tree, or a
+// tANS table if that is estimated smaller. Returns false if out of memory.
+static bool encode_source(BlockState *st, int outfile, BlockHeader *bh, Source *src) {
+    uint64_t hist[ALPHABET] = { 0 };
+    kernel.hist(src->syms, src->count, hist);
+
+    if (st->valid) {
+        uint64_t bits = 0;
+        bool fits = true;
+        for (int i = 0; i < ALPHABET && fits; i++) {
+            if (hist[i]) {
+                fits = code_size(&st->table[i]) > 0;
+                bits += hist[i] * code_size(&st->table[i]);
+            }
+        }
+        double repeat = bits + 8.0 * sizeof(BlockHeader);
+        if (fits && repeat <= block_cost(hist, src->count) * (1.0 + REPEAT_SLACK)) {
+            bh->type = BLOCK_REPEAT;
+            return write_coded(outfile, bh, src, NULL, st->table, bits);
+        }
+    }
+
+    uint64_t tree_hist[ALPHABET];
+    prep_hist(tree_hist); // zeroes and adds min values
+    for (int i = 0; i < ALPHABET; i++) {
+        tree_hist[i] += hist[i];
+    }
+    Node *root = build_tree(tree_hist);
+    Code table[ALPHABET] = { { 0 } };
+    build_codes(root, table);
+
+    uint64_t bits = 0;
+    for (int i = 0; i < ALPHABET; i++) {
+        if (tree_hist[i]) {
+            bits += hist[i] * code_size(&table[i]);
+            bh->tree_size += 3;
+        }
+    }
+    bh->tree_size--;
+
+    // tANS wins on skewed data where whole-bit code lengths waste space
+    uint16_t freq[ALPHABET];
+    tans_normalize(hist, src->count, freq);
+    uint8_t freqs[1 + 3 * ALPHABET];
+    uint32_t freqs_size = tans_write_table(freq, freqs);
+    bool ok;
+    if (tans_cost(hist, freq) + 8.0 * freqs_size < bits + 8.0 * bh->tree_size) {
+        bh->type = BLOCK_TANS;
+        bh->tree_size = freqs_size;
+        ok = write_tans(outfile, bh, src, freqs, freq);
+    } else {
+        char dump[MAX_TREE_SIZE];
+        tree_dump(dump, root);
+        ok = write_coded(outfile, bh, src, dump, table, bits);
+    }
+
+    // Only a table the decoder actually saw can be repeated
+    if (ok && bh->type == BLOCK_HUFFMAN) {
+        memcpy(st->table, table, sizeof(table));
+        st->valid = true;
+    }
+    delete_tree(&root);
+    return ok;
+}
+
+// Codes the n bytes of data, the block filtered or not, as 16-bit symbols
+// if that beats best, the estimate for coding bytes, and sets *coded.
+// Returns false, writing nothing, if out of memory.
+static bool encode_wide(WideCoder *w, int outfile, BlockHeader *bh, Source *src, const uint8_t *data, double best,
+    bool *coded) {
+    uint32_t table_size;
+    uint64_t bits;
+    *coded = false;
+    if (!wide_plan(w, data, src->n, &bits, &table_size)) {
+        return false;
+    }
+    BlockHeader wh = *bh;
+    wh.type = BLOCK_WIDE;
+    wh.flags &= ~BLOCK_BWT;
+    double extra = 8.0 * (table_size + block_extra(&wh) + sizeof(BlockHeader));
+    if (table_size > UINT16_MAX || bits + extra >= best) {
+        return true;
+    }
+    wh.tree_size = table_size;
+    uint32_t payload_size = (bits + 7) / 8;
+    if (!write_stored(outfile, &wh, src, payload_size)) {
+        uint8_t *table = (uint8_t *) malloc(table_size);
+        uint8_t *payload = (uint8_t *) calloc(payload_size + 8, 1);
+        if (!table || !payload) {
+            free(table);
+            free(payload);
+            return false;
+        }
+        wide_write_table(w, table);
+        wide_encode(w, data, src->n, payload);
+        wh.payload_size = payload_size;
+        write_block(outfile, &wh, src, table, payload);
+        free(table);
+        free(payload);
+    }
+    *coded = true;
+    return true;
+}
+
+// Order-0 estimate of the block delta coded with stride, from a sample
+static double filter_cost(const uint8_t *buf, uint32_t n, uint32_t stride, uint8_t *scratch) {
+    uint64_t hist[ALPHABET] = { 0 };
+    kernel.filter(buf, n, stride, false, scratch);
+    kernel.hist(scratch, n, hist);
+    return block_cost(hist, n);
+}
+
+// Picks the stride whose deltas look cheapest on a sample of the block,
+// the given one unless STRIDE_AUTO, into *chosen. Sets 0 if none beats
+// raw bytes. Returns false if out of memory.
+static bool filter_stride(uint8_t stride, const uint8_t *buf, uint32_t n, uint8_t *chosen) {
+    uint32_t sample = n < FILTER_SAMPLE ? n : FILTER_SAMPLE;
+    uint8_t *scratch = (uint8_t *) malloc(sample);
+    if (!scratch) {
+        return false;
+    }
+    uint64_t hist[ALPHABET] = { 0 };
+    kernel.hist(buf, sample, hist);
+    double best = block_cost(hist, sample) * FILTER_GAIN;
+    *chosen = 0;
+    for (uint32_t s = 1; s <= MAX_STRIDE; s *= 2) {
+        if (stride == STRIDE_AUTO || stride == s) {
+            double cost = filter_cost(buf, sample, s, scratch);
+            if (cost < best) {
+                best = cost;
+                *chosen = s;
+            }
+        }
+    }
+    free(scratch);
+    return true;
+}
+
+// Code n bytes as one block. Optionally delta coded first, then through
+// BWT and move-to-front or as 16-bit symbols, each only if estimated
+// smaller. Returns false, with nothing written, if out of memory.
+bool encode_block(BlockState *st, int outfile, const uint8_t *buf, uint32_t n) {
+    BlockHeader bh = { .type = BLOCK_HUFFMAN, .flags = 0, .tree_size = 0, .raw_size = n };
+    Source src = { buf, n, buf, n, NULL, NULL };
+    if (n < 2 || (!st->bwt && !st->wide && !st->stride)) {
+        return encode_source(st, outfile, &bh, &src);
+    }
+
+    uint64_t raw_hist[ALPHABET] = { 0 };
+    kernel.hist(buf, n, raw_hist);
+    double best = block_cost(raw_hist, n);
+    uint8_t *filtered = NULL;
+    Filter filter = { .stride = 0, .planes = 0, .reserved = 0 };
+    if (st->stride && !filter_stride(st->stride, buf, n, &filter.stride)) {
+        return false;
+    }
+    if (filter.stride) {
+        // Byte planes only help when BWT can find contexts within a plane
+        filter.planes = st->bwt && filter.stride > 1 && !st->wide;
+        filtered = (uint8_t *) malloc(n);
+        if (!filtered) {
+            return false;
+        }
+        kernel.filter(buf, n, filter.stride, filter.planes, filtered);
+        uint64_t hist[ALPHABET] = { 0 };
+        kernel.hist(filtered, n, hist);
+        double cost = block_cost(hist, n) + 8.0 * sizeof(Filter);
+        if (cost < best) {
+            best = cost;
+            bh.flags = BLOCK_FILTER;
+            src.syms = filtered;
+            src.filter = &filter;
+        }
+    }
+
+    const uint8_t *data = src.syms;
+    uint8_t *sorted = NULL;
+    uint8_t *syms = NULL;
+    Transform tf;
+    if (st->bwt) {
+        sorted = (uint8_t *) malloc(n);
+        syms = (uint8_t *) malloc(2 * (uint64_t) n);
+        if (!sorted || !syms || !bwt_forward(data, n, sorted, &tf.primary)) {
+            free(filtered);
+            free(sorted);
+            free(syms);
+            return false;
+        }
+        tf.size = mtf_encode(sorted, n, syms);
+
+        // Keep the transform only if its order-0 estimate is smaller
+        uint64_t hist[ALPHABET] = { 0 };
+        kernel.hist(syms, tf.size, hist);
+        double cost = block_cost(hist, tf.size) + 8.0 * (block_extra(&bh) + sizeof(Transform));
+        if (cost < best) {
+            best = cost;
+            bh.flags |= BLOCK_BWT;
+            src.syms = syms;
+            src.count = tf.size;
+            src.tf = &tf;
+        }
+    }
+    bool coded = false;
+    bool ok = !st->wide || encode_wide(st->wide, outfile, &bh, &src, data, best, &coded);
+    if (ok && !coded) {
+        ok = encode_source(st, outfile, &bh, &src);
+    }
+    free(filtered);
+    free(sorted);
+    free(syms);
+    return ok;
+}
+
+// Tables and scratch share one mapping, so with placement.huge they sit on
+// a few huge pages local to the thread that decodes with them
+#define DECODER_SIZE (sizeof(BlockDecoder) + 5 * (uint64_t) MAX_BLOCK + 1 + (MAX_BLOCK + 1) * sizeof(uint32_t))
+
+BlockDecoder *block_decoder_create(void) {
+    BlockDecoder *d = (BlockDecoder *) place_alloc(DECODER_SIZE);
+    if (d) {
+        d->table.root = NULL;
+        d->rows = (uint32_t *) &d[1];
+        d->syms = (uint8_t *) &d->rows[MAX_BLOCK + 1];
+        d->sorted = d->syms + 2 * MAX_BLOCK + 1;
+        d->filtered = d->sorted + MAX_BLOCK;
+    }
+    return d;
+}
+
+void block_decoder_delete(BlockDecoder **d) {
+    place_free(*d, DECODER_SIZE);
+    *d = NULL;
+}
+
+// Checks a block header read from untrusted input before anything is
+// read or allocated from it. An encoder only codes a block when that is
+// smaller than storing it, so no block takes more than MAX_BLOCK bytes.
+bool block_valid(BlockHeader *bh) {
+    uint64_t size = (uint64_t) block_extra(bh) + bh->tree_size + bh->payload_size;
+    if ((bh->flags & ~(BLOCK_BWT | BLOCK_FILTER)) || bh->raw_size > MAX_BLOCK || size > MAX_BLOCK) {
+        return false;
+    }
+    switch (bh->type) {
+    case BLOCK_HUFFMAN: return bh->tree_size <= MAX_TREE_SIZE;
+    case BLOCK_TANS: return bh->tree_size <= 1 + 3 * ALPHABET;
+    case BLOCK_STORED: return bh->tree_size == 0 && bh->payload_size == bh->raw_size && !bh->flags;
+    case BLOCK_REPEAT: return bh->tree_size == 0;
+    case BLOCK_WIDE: return !(bh->flags & BLOCK_BWT);
+    default: return false;
+    }
+}
+
+// Decodes a block already in memory after block_valid(), payload holds the
+// transform header if any, the tree dump then the codes. The tree stays in
+// d for following repeat blocks. Returns false if the block does not
+// produce raw_size bytes.
+bool decode_block(BlockHeader *bh, uint8_t *payload, BlockDecoder *d, uint8_t *out) {
+    if (bh->flags & BLOCK_FILTER) {
+        Filter f;
+        memcpy(&f, payload, sizeof(f));
+        bool power = f.stride && !(f.stride & (f.stride - 1));
+        if (!power || f.stride > MAX_STRIDE || f.planes > 1 || f.reserved) {
+            return false;
+        }
+        BlockHeader inner = *bh;
+        inner.flags &= ~BLOCK_FILTER;
+        if (!decode_block(&inner, &payload[sizeof(f)], d, d->filtered)) {
+            return false;
+        }
+        kernel.unfilter(d->filtered, bh->raw_size, f.stride, f.planes, out);
+        return true;
+    }
+    if (bh->flags & BLOCK_BWT) {
+        Transform tf;
+        memcpy(&tf, payload, sizeof(tf));
+        if (tf.size > 2 * (uint64_t) bh->raw_size) {
+            return false;
+        }
+        // Decode the coded symbols as an untransformed block of tf.size
+        BlockHeader inner = *bh;
+        inner.flags = 0;
+        inner.raw_size = tf.size;
+        return decode_block(&inner, &payload[sizeof(tf)], d, d->syms)
+               && mtf_decode(d->syms, tf.size, d->sorted, bh->raw_size)
+               && bwt_inverse(d->sorted, bh->raw_size, tf.primary, d->rows, out);
+    }
+    if (bh->type == BLOCK_STORED) {
+        memcpy(out, payload, bh->raw_size);
+        return true;
+    }
+    if (bh->type == BLOCK_TANS) {
+        uint16_t freq[ALPHABET];
+        if (!tans_read_table(payload, bh->tree_size, freq)) {
+            return false;
+        }
+        tans_build(freq, d->states);
+        uint64_t nbits = (uint64_t) bh->payload_size * 8;
+        return tans_decode(d->states, &payload[bh->tree_size], nbits, out, bh->raw_size);
+    }
+    if (bh->type == BLOCK_WIDE) {
+        uint64_t nbits = (uint64_t) bh->payload_size * 8;
+        return wide_read_table(&d->wide, payload, bh->tree_size)
+               && wide_decode(&d->wide, &payload[bh->tree_size], nbits, out, bh->raw_size);
+    }
+    DecodeTable *t = &d->table;
+    if (bh->type == BLOCK_HUFFMAN && !table_load(t, bh->tree_size, payload)) {
+        return false;
+    } else if (!t->root) {
+        return false; // Repeat block without a tree
+    }
+    uint64_t nbits = (uint64_t) bh->payload_size * 8;
+    uint64_t pos = 0;
+    uint64_t n = kernel.decode(t, &payload[bh->tree_size], nbits, &pos, nbits, out, bh->raw_size);
+    return n == bh->raw_size;
+}
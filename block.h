@@ -0,0 +1,91 @@
+#ifndef __BLOCK_H__
+#define __BLOCK_H__
+
+#include "code.h"
+#include "defines.h"
+#include "table.h"
+#include "tans.h"
+#include "wide.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Block types
+#define BLOCK_HUFFMAN 'H' // Tree dump followed by codes.
+#define BLOCK_STORED  'S' // Raw bytes.
+#define BLOCK_REPEAT  'R' // Codes using the previous block's tree.
+#define BLOCK_TANS    'A' // Normalized frequencies followed by tANS states.
+#define BLOCK_WIDE    'W' // Code lengths followed by 16-bit symbol codes.
+#define BLOCK_SYNC    'Y' // Sync point, everything before it can be decoded.
+#define BLOCK_END     'E' // End of stream.
+
+// Block flags
+#define BLOCK_BWT    0x1 // Coded symbols are the BWT and move-to-front of the data.
+#define BLOCK_FILTER 0x2 // Data was delta coded with a stride before anything else.
+
+#define STRIDE_AUTO 0xff // Detect the prefilter stride per block.
+#define MAX_STRIDE  16 // Strides are powers of two up to this.
+
+typedef struct BlockHeader {
+    uint8_t type;
+    uint8_t flags;
+    uint16_t tree_size; // Tree dump or frequency table bytes.
+    uint32_t raw_size; // Uncompressed bytes in the block.
+    uint32_t payload_size; // Bytes following the tree dump.
+} BlockHeader;
+
+// Follows the block header when BLOCK_FILTER is set
+typedef struct Filter {
+    uint8_t stride; // Bytes per record.
+    uint8_t planes; // Whole records were then split into byte planes.
+    uint16_t reserved;
+} Filter;
+
+// Follows the block header, and any Filter, when BLOCK_BWT is set
+typedef struct Transform {
+    uint32_t primary; // BWT row of the original data.
+    uint32_t size; // Coded symbols after move-to-front and zero runs.
+} Transform;
+
+// Encoder settings and state carried between blocks
+typedef struct BlockState {
+    bool bwt; // Transform blocks before coding.
+    uint8_t stride; // Prefilter stride, 0 for none or STRIDE_AUTO.
+    WideCoder *wide; // Try 16-bit symbols, NULL when disabled.
+    bool valid; // A previous tree was written.
+    Code table[ALPHABET]; // Its codes, empty for symbols it lacks.
+} BlockState;
+
+// Decode state for one stream. All memory is allocated up front for the
+// largest block, so malformed input cannot grow it.
+typedef struct BlockDecoder {
+    DecodeTable table; // Tree of the last Huffman block, for repeat blocks.
+    TansEntry states[TANS_SIZE];
+    WideTable wide;
+    uint8_t *syms; // Coded symbols of a transformed block.
+    uint8_t *sorted; // Their move-to-front decoding, the block's BWT.
+    uint32_t *rows; // bwt_inverse() scratch.
+    uint8_t *filtered; // A filtered block before unfiltering.
+} BlockDecoder;
+
+static inline uint32_t block_extra(BlockHeader *bh) {
+    return (bh->flags & BLOCK_FILTER ? sizeof(Filter) : 0) + (bh->flags & BLOCK_BWT ? sizeof(Transform) : 0);
+}
+
+double block_cost(uint64_t hist[static ALPHABET], uint64_t n);
+
+uint64_t predict_block(uint64_t hist[static ALPHABET], uint32_t n, uint64_t *overhead);
+
+uint32_t block_split(const uint8_t *buf, uint32_t n, uint32_t effort);
+
+bool encode_block(BlockState *st, int outfile, const uint8_t *buf, uint32_t n);
+
+BlockDecoder *block_decoder_create(void);
+
+void block_decoder_delete(BlockDecoder **d);
+
+bool block_valid(BlockHeader *bh);
+
+bool decode_block(BlockHeader *bh, uint8_t *payload, BlockDecoder *d, uint8_t *out);
+
+#endif
@@ -0,0 +1,301 @@
+#include "bwt.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Zero-run symbols after move-to-front, runs of zeros are written in
+// bijective base 2 with RUNA as digit 1 and RUNB as digit 2 (as in bzip2)
+#define RUNA   0
+#define RUNB   1
+#define ESCAPE 255 // Followed by v - 254 for MTF values 254 and 255.
+
+#define IS_LMS(i) ((i) > 0 && t[i] && !t[(i) - 1])
+
+static void get_buckets(const int32_t *s, int32_t n, int32_t k, int32_t *bkt, bool end) {
+    memset(bkt, 0, k * sizeof(int32_t));
+    for (int32_t i = 0; i < n; i++) {
+        bkt[s[i]]++;
+    }
+    int32_t sum = 0;
+    for (int32_t c = 0; c < k; c++) {
+        sum += bkt[c];
+        bkt[c] = end ? sum : sum - bkt[c];
+    }
+}
+
+// Induce L-type suffixes left to right, then S-type right to left
+static void induce(const int32_t *s, int32_t *sa, const uint8_t *t, int32_t n, int32_t k, int32_t *bkt) {
+    get_buckets(s, n, k, bkt, false);
+    for (int32_t i = 0; i < n; i++) {
+        int32_t j = sa[i] - 1;
+        if (sa[i] > 0 && !t[j]) {
+            sa[bkt[s[j]]++] = j;
+        }
+    }
+    get_buckets(s, n, k, bkt, true);
+    for (int32_t i = n - 1; i >= 0; i--) {
+        int32_t j = sa[i] - 1;
+        if (sa[i] > 0 && t[j]) {
+            sa[--bkt[s[j]]] = j;
+        }
+    }
+}
+
+// Linear time suffix array by induced sorting (SA-IS). s holds n symbols
+// in [0, k) and ends with a unique smallest sentinel. Returns false if
+// out of memory.
+static bool sais(const int32_t *s, int32_t *sa, int32_t n, int32_t k) {
+    uint8_t *t = (uint8_t *) malloc(n); // 1 for S-type, 0 for L-type
+    int32_t *bkt = (int32_t *) malloc(k * sizeof(int32_t));
+    if (!t || !bkt) {
+        free(t);
+        free(bkt);
+        return false;
+    }
+    t[n - 1] = 1;
+    for (int32_t i = n - 2; i >= 0; i--) {
+        t[i] = s[i] < s[i + 1] || (s[i] == s[i + 1] && t[i + 1]);
+    }
+
+    // Sort LMS substrings by inducing from their bucket ends
+    get_buckets(s, n, k, bkt, true);
+    for (int32_t i = 0; i < n; i++) {
+        sa[i] = -1;
+    }
+    for (int32_t i = 1; i < n; i++) {
+        if (IS_LMS(i)) {
+            sa[--bkt[s[i]]] = i;
+        }
+    }
+    induce(s, sa, t, n, k, bkt);
+
+    // Compact the sorted LMS substrings and name them
+    int32_t n1 = 0;
+    for (int32_t i = 0; i < n; i++) {
+        if (IS_LMS(sa[i])) {
+            sa[n1++] = sa[i];
+        }
+    }
+    for (int32_t i = n1; i < n; i++) {
+        sa[i] = -1;
+    }
+    int32_t name = 0;
+    int32_t prev = -1;
+    for (int32_t i = 0; i < n1; i++) {
+        int32_t pos = sa[i];
+        bool diff = false;
+        for (int32_t d = 0; d < n; d++) {
+            if (prev == -1 || s[pos + d] != s[prev + d] || t[pos + d] != t[prev + d]) {
+                diff = true;
+                break;
+            } else if (d > 0 && (IS_LMS(pos + d) || IS_LMS(prev + d))) {
+                break;
+            }
+        }
+        if (diff) {
+            name++;
+            prev = pos;
+        }
+        sa[n1 + pos / 2] = name - 1;
+    }
+    for (int32_t i = n - 1, j = n - 1; i >= n1; i--) {
+        if (sa[i] >= 0) {
+            sa[j--] = sa[i];
+        }
+    }
+
+    // Sort the reduced string, recursing if names are not yet unique
+    int32_t *s1 = sa + n - n1;
+    if (name < n1) {
+        if (!sais(s1, sa, n1, name)) {
+            free(t);
+            free(bkt);
+            return false;
+        }
+    } else {
+        for (int32_t i = 0; i < n1; i++) {
+            sa[s1[i]] = i;
+        }
+    }
+
+    // Place LMS suffixes in sorted order and induce the rest
+    get_buckets(s, n, k, bkt, true);
+    for (int32_t i = 1, j = 0; i < n; i++) {
+        if (IS_LMS(i)) {
+            s1[j++] = i;
+        }
+    }
+    for (int32_t i = 0; i < n1; i++) {
+        sa[i] = s1[sa[i]];
+    }
+    for (int32_t i = n1; i < n; i++) {
+        sa[i] = -1;
+    }
+    for (int32_t i = n1 - 1; i >= 0; i--) {
+        int32_t j = sa[i];
+        sa[i] = -1;
+        sa[--bkt[s[j]]] = j;
+    }
+    induce(s, sa, t, n, k, bkt);
+    free(t);
+    free(bkt);
+    return true;
+}
+
+// Burrows-Wheeler transform of in (n > 0) into out, sets the primary
+// index: the row of the sentinel, which is left out of out. Returns false
+// if out of memory.
+bool bwt_forward(const uint8_t *in, uint32_t n, uint8_t *out, uint32_t *primary) {
+    int32_t *s = (int32_t *) malloc((n + 1) * sizeof(int32_t));
+    int32_t *sa = (int32_t *) malloc((n + 1) * sizeof(int32_t));
+    if (!s || !sa) {
+        free(s);
+        free(sa);
+        return false;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        s[i] = in[i] + 1;
+    }
+    s[n] = 0;
+    bool ok = sais(s, sa, n + 1, 257);
+
+    *primary = 0;
+    for (uint32_t i = 0, j = 0; ok && i <= n; i++) {
+        if (sa[i] == 0) {
+            *primary = i;
+        } else {
+            out[j++] = in[sa[i] - 1];
+        }
+    }
+    free(s);
+    free(sa);
+    return ok;
+}
+
+// Inverts the transform walking forward through the rows. Each entry packs
+// the next row with the row's first byte, so every output byte costs one
+// random access. rows needs n + 1 entries.
+bool bwt_inverse(const uint8_t *in, uint32_t n, uint32_t primary, uint32_t *rows, uint8_t *out) {
+    if (primary > n || primary == 0) {
+        return false;
+    }
+    uint32_t start[256];
+    uint32_t sum = 1; // Row 0 is the sentinel's
+    uint32_t count[256] = { 0 };
+    for (uint32_t i = 0; i < n; i++) {
+        count[in[i]]++;
+    }
+    for (int c = 0; c < 256; c++) {
+        start[c] = sum;
+        sum += count[c];
+    }
+
+    uint32_t *tt = rows;
+    tt[0] = primary << 8;
+    for (uint32_t i = 0; i <= n; i++) {
+        if (i == primary) {
+            continue;
+        }
+        uint8_t c = in[i < primary ? i : i - 1];
+        tt[start[c]++] = (i << 8) | c;
+    }
+    uint32_t row = tt[0] >> 8;
+    for (uint32_t k = 0; k < n; k++) {
+        uint32_t e = tt[row];
+        out[k] = e & 0xff;
+        row = e >> 8;
+    }
+    return true;
+}
+
+static uint32_t put_run(uint8_t *out, uint32_t len, uint32_t run) {
+    while (run) {
+        if (run & 1) {
+            out[len++] = RUNA;
+            run = (run - 1) >> 1;
+        } else {
+            out[len++] = RUNB;
+            run = (run - 2) >> 1;
+        }
+    }
+    return len;
+}
+
+// Move-to-front then zero-run coding, out needs 2n bytes. Returns the
+// coded size.
+uint32_t mtf_encode(const uint8_t *in, uint32_t n, uint8_t *out) {
+    uint8_t order[256];
+    for (int c = 0; c < 256; c++) {
+        order[c] = c;
+    }
+    uint32_t len = 0;
+    uint32_t run = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint8_t c = in[i];
+        if (order[0] == c) {
+            run++;
+            continue;
+        }
+        len = put_run(out, len, run);
+        run = 0;
+        uint32_t v = 1;
+        while (order[v] != c) {
+            v++;
+        }
+        memmove(&order[1], order, v);
+        order[0] = c;
+        if (v < 254) {
+            out[len++] = v + 1;
+        } else {
+            out[len++] = ESCAPE;
+            out[len++] = v - 254;
+        }
+    }
+    return put_run(out, len, run);
+}
+
+// Returns false unless the size coded bytes give exactly n bytes
+bool mtf_decode(const uint8_t *in, uint32_t size, uint8_t *out, uint32_t n) {
+    uint8_t order[256];
+    for (int c = 0; c < 256; c++) {
+        order[c] = c;
+    }
+    uint32_t len = 0;
+    uint32_t i = 0;
+    while (i < size) {
+        if (in[i] <= RUNB) {
+            uint64_t run = 0;
+            uint64_t weight = 1;
+            while (i < size && in[i] <= RUNB && weight <= n) {
+                run += (in[i] + 1) * weight;
+                weight <<= 1;
+                i++;
+            }
+            if (run > n - len) {
+                return false;
+            }
+            memset(&out[len], order[0], run);
+            len += run;
+            continue;
+        }
+        uint32_t v = in[i] - 1;
+        if (in[i] == ESCAPE) {
+            if (i + 1 >= size || in[i + 1] > 1) {
+                return false;
+            }
+            v = 254 + in[i + 1];
+            i++;
+        }
+        i++;
+        if (len == n) {
+            return false;
+        }
+        uint8_t c = order[v];
+        memmove(&order[1], order, v);
+        order[0] = c;
+        out[len++] = c;
+    }
+    return len == n;
+}
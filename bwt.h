@@ -0,0 +1,15 @@
+#ifndef __BWT_H__
+#define __BWT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+bool bwt_forward(const uint8_t *in, uint32_t n, uint8_t *out, uint32_t *primary);
+
+bool bwt_inverse(const uint8_t *in, uint32_t n, uint32_t primary, uint32_t *rows, uint8_t *out);
+
+uint32_t mtf_encode(const uint8_t *in, uint32_t n, uint8_t *out);
+
+bool mtf_decode(const uint8_t *in, uint32_t size, uint8_t *out, uint32_t n);
+
+#endif
@@ -0,0 +1,489 @@
+#include "codec.h"
+
+#include "block.h"
+#include "code.h"
+#include "defines.h"
+#include "header.h"
+#include "huffman.h"
+#include "index.h"
+#include "io.h"
+#include "kernel.h"
+#include "node.h"
+#include "parallel.h"
+#include "place.h"
+#include "table.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h> // only use for printf, else use io.c
+#include <stdlib.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PAYLOAD_SIZE (MAX_BLOCK + MAX_TREE_SIZE + 8) // Largest block payload.
+
+// Buffers are mapped by place_alloc(), so create the codec on the thread
+// that will use it
+Codec *codec_create(uint32_t threads) {
+    Codec *c = (Codec *) malloc(sizeof(Codec));
+    if (c) {
+        c->threads = threads;
+        c->blocks = false;
+        c->streaming = false;
+        c->interval = SYNC_INTERVAL;
+        c->effort = 0;
+        c->block_size = MAX_BLOCK;
+        c->state.bwt = false;
+        c->state.stride = 0;
+        c->state.wide = NULL;
+        c->pending = 0;
+        c->uncompressed = 0;
+        c->compressed = 0;
+        c->base = 0;
+        c->decoder = block_decoder_create();
+        c->raw = (uint8_t *) place_alloc(MAX_BLOCK);
+        c->payload = (uint8_t *) place_alloc(PAYLOAD_SIZE);
+        memset(c->nodes, 0, sizeof(c->nodes));
+        c->index = index_create();
+        if (!c->decoder || !c->raw || !c->payload || !c->index) {
+            block_decoder_delete(&c->decoder);
+            place_free(c->raw, MAX_BLOCK);
+            place_free(c->payload, PAYLOAD_SIZE);
+            index_delete(&c->index);
+            free(c);
+            c = NULL;
+        }
+    }
+    return c;
+}
+
+void codec_delete(Codec **c) {
+    if (*c) {
+        block_decoder_delete(&(*c)->decoder);
+        wide_delete(&(*c)->state.wide);
+        place_free((*c)->raw, MAX_BLOCK);
+        place_free((*c)->payload, PAYLOAD_SIZE);
+        index_delete(&(*c)->index);
+        free(*c);
+        *c = NULL;
+    }
+}
+
+void fill_hist(int infile, uint64_t *hist) {
+    uint8_t buffer[BLOCK];
+    int num_read = 0;
+    while ((num_read = read_bytes(infile, buffer, BLOCK)) != 0) {
+        kernel.hist(buffer, num_read, hist);
+    }
+}
+
+// Fills header with information, hist to count tree size
+Header make_header(int infile, uint64_t *hist) {
+    Header h;
+    h.magic = MAGIC;
+
+    struct stat statbuf; 
+    assert(fstat(infile, &statbuf) != -1);
+    h.permissions = statbuf.st_mode;
+
+    h.tree_size = 0;
+    // Tree size = 3x(unique symbols)-1
+    for (int i = 0; i < ALPHABET; i++) {
+        if (hist[i] != 0) {
+            h.tree_size += 3;
+        }
+    }
+    h.tree_size--;
+    h.file_size = statbuf.st_size;
+    return h;
+}
+
+// Code pending input as blocks, keeping back a partial block unless drain.
+// Returns false if a block or its index entry cannot be allocated.
+static bool stream_blocks(Codec *c, int outfile, bool drain) {
+    while (c->pending >= c->block_size || (drain && c->pending)) {
+        uint32_t len = c->pending < c->block_size ? c->pending : c->block_size;
+        uint32_t cut = block_split(c->raw, len, c->effort);
+        if (!index_add(c->index, c->base + bytes_written, c->uncompressed)
+            || !encode_block(&c->state, outfile, c->raw, cut)) {
+            return false;
+        }
+        memmove(c->raw, &c->raw[cut], c->pending - cut);
+        c->pending -= cut;
+        c->uncompressed += cut;
+    }
+    return true;
+}
+
+// Starts a block format stream of file_size bytes, UINT64_MAX if unknown,
+// at the start of outfile after io_reset()
+void stream_begin(Codec *c, int outfile, uint16_t permissions, uint64_t file_size) {
+    Header h;
+    h.magic = MAGIC_BLOCKS;
+    h.permissions = permissions;
+    h.tree_size = 0;
+    h.file_size = file_size;
+    write_bytes(outfile, (uint8_t *) &h, sizeof(h));
+    c->state.valid = false;
+    c->pending = 0;
+    c->uncompressed = 0;
+    c->base = 0;
+    c->index->count = 0;
+}
+
+bool stream_write(Codec *c, int outfile, const uint8_t *buf, uint32_t n) {
+    while (n) {
+        uint32_t take = MAX_BLOCK - c->pending < n ? MAX_BLOCK - c->pending : n;
+        memcpy(&c->raw[c->pending], buf, take);
+        c->pending += take;
+        buf += take;
+        n -= take;
+        if (!stream_blocks(c, outfile, false)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Codes everything written so far and emits a sync block, after which the
+// receiver can decode all of it without waiting for more input
+bool stream_flush(Codec *c, int outfile) {
+    if (!stream_blocks(c, outfile, true)) {
+        return false;
+    }
+    BlockHeader sync = { .type = BLOCK_SYNC };
+    write_bytes(outfile, (uint8_t *) &sync, sizeof(sync));
+    return true;
+}
+
+// Ends the stream with an end block and the index of all blocks
+bool stream_end(Codec *c, int outfile) {
+    if (!stream_blocks(c, outfile, true)) {
+        return false;
+    }
+    uint64_t offset = c->base + bytes_written;
+    BlockHeader end = { .type = BLOCK_END };
+    write_bytes(outfile, (uint8_t *) &end, sizeof(end));
+    index_write(c->index, outfile, offset, c->uncompressed);
+    c->compressed = bytes_written;
+    return true;
+}
+
+static uint64_t stream_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+// Reads infile into blocks until the end of input. Streaming syncs when
+// caught up with the input, or after interval ms of input that never
+// pauses. Returns false, with the stream left unended, if a block could
+// not be coded.
+static bool stream_input(Codec *c, int infile, int outfile) {
+    uint8_t buf[BLOCK];
+    int num_read = 0;
+    bool ok = true;
+    if (c->streaming) {
+        struct pollfd pfd = { .fd = infile, .events = POLLIN };
+        uint64_t synced = stream_ms();
+        while (ok && (num_read = read_some(infile, buf, BLOCK)) > 0) {
+            ok = stream_write(c, outfile, buf, num_read);
+            if (ok && (poll(&pfd, 1, 0) == 0 || stream_ms() - synced >= c->interval)) {
+                ok = stream_flush(c, outfile);
+                synced = stream_ms();
+            }
+        }
+    } else {
+        while (ok && (num_read = read_bytes(infile, buf, BLOCK)) != 0) {
+            ok = stream_write(c, outfile, buf, num_read);
+        }
+    }
+    if (!ok || !stream_end(c, outfile)) {
+        fprintf(stderr, "Error: not enough memory to encode a block\n");
+        return false;
+    }
+    return true;
+}
+
+// Block format: the header then blocks cut by block_split(), each with its
+// own tree, until an end block. Input is read once so pipes work too.
+// Streaming flushes whenever the input has no more data ready.
+bool encode_blocks(Codec *c, int infile, int outfile) {
+    struct stat statbuf;
+    fstat(infile, &statbuf);
+    bool known = S_ISREG(statbuf.st_mode) && !c->streaming;
+    uint64_t file_size = known ? (uint64_t) statbuf.st_size : UINT64_MAX;
+    fchmod(outfile, statbuf.st_mode);
+    stream_begin(c, outfile, statbuf.st_mode, file_size);
+    if (!stream_input(c, infile, outfile)) {
+        return false;
+    }
+
+    // Size was unknown up front, patch it in if the output can seek
+    if (file_size != c->uncompressed) {
+        Header h;
+        h.magic = MAGIC_BLOCKS;
+        h.permissions = statbuf.st_mode;
+        h.tree_size = 0;
+        h.file_size = c->uncompressed;
+        pwrite(outfile, &h, sizeof(h), 0);
+    }
+    return true;
+}
+
+// Adds infile as new blocks at the end of the block format file outfile,
+// opened for reading and writing. The old end block and index are
+// overwritten and the header's size patched; existing blocks are not read.
+// An empty outfile is encoded from scratch.
+bool append_file(Codec *c, int infile, int outfile) {
+    io_reset();
+    struct stat statbuf;
+    if (fstat(outfile, &statbuf) || !S_ISREG(statbuf.st_mode)) {
+        fprintf(stderr, "Error: can only append to a regular file\n");
+        return false;
+    }
+    if (statbuf.st_size == 0) {
+        return encode_blocks(c, infile, outfile);
+    }
+
+    Header h;
+    IndexTrailer t;
+    if (pread(outfile, &h, sizeof(h), 0) != sizeof(h) || h.magic != MAGIC_BLOCKS) {
+        fprintf(stderr, "Error: can only append to the block format\n");
+        return false;
+    }
+    if (!index_load(c->index, outfile, &t)) {
+        fprintf(stderr, "Error: corrupt block index\n");
+        return false;
+    }
+
+    // Continue from the old end block. The decoder still holds the last
+    // tree there, but the first new block must not rely on it.
+    lseek(outfile, t.end, SEEK_SET);
+    c->base = t.end;
+    c->state.valid = false;
+    c->pending = 0;
+    c->uncompressed = t.raw_size;
+    if (!stream_input(c, infile, outfile)) {
+        return false;
+    }
+    if (ftruncate(outfile, c->base + bytes_written)) {
+        fprintf(stderr, "Error: could not truncate output\n");
+        return false;
+    }
+
+    h.file_size = c->uncompressed;
+    pwrite(outfile, &h, sizeof(h), 0);
+    c->uncompressed -= t.raw_size;
+    return true;
+}
+
+bool encode_file(Codec *c, int infile, int outfile) {
+    io_reset();
+    if (c->blocks) {
+        return encode_blocks(c, infile, outfile);
+    }
+
+    // Construct histogram
+    uint64_t hist[ALPHABET];
+    prep_hist(hist); //zeroes and adds min values
+    fill_hist(infile, hist);
+
+    // Construct Huffman tree and build code table
+    Node *root = build_tree(hist);
+    Code table[ALPHABET];
+    build_codes(root, table);
+
+    // Construct header and set perms in outfile, then write to outfile
+    Header h = make_header(infile, hist);
+    fchmod(outfile, h.permissions);
+    write_bytes(outfile, (uint8_t *) &h, sizeof(h));
+
+    // Write tree to outfile (post-order traversal)
+    char dump[h.tree_size];
+    tree_dump(dump, root);
+    write_bytes(outfile, (uint8_t *) dump, h.tree_size);
+
+    // Write code for each symbol in infile then flush_codes
+    lseek(infile, 0, SEEK_SET); //reset position in infile (from hist fill)
+    uint8_t buf[BLOCK];
+    int num_read = 0;
+    while ((num_read = read_bytes(infile, buf, BLOCK)) != 0) {
+        write_symbols(outfile, buf, num_read, table);
+    }
+    flush_codes(outfile);
+
+    c->uncompressed = h.file_size;
+    c->compressed = bytes_written;
+    delete_tree(&root);
+    return true;
+}
+
+// Decode in chunks with a multi-symbol lookup table, keeping enough
+// unconsumed bits in the buffer for the longest possible code. Returns
+// false if the input ends before file_size bytes are decoded.
+bool decode_serial(Codec *c, int infile, int outfile, Header *h) {
+    uint8_t in[2 * BLOCK];
+    uint8_t out[BLOCK];
+    uint64_t nbytes = 0;
+    uint64_t pos = 0; // bit position in in
+    uint64_t decoded = 0;
+    bool eof = false;
+    while (decoded < h->file_size) {
+        // Move the unconsumed tail to the front and refill
+        uint64_t keep = pos / 8;
+        memmove(in, &in[keep], nbytes - keep);
+        nbytes -= keep;
+        pos -= keep * 8;
+        if (!eof) {
+            int to_read = sizeof(in) - nbytes;
+            int num_read = read_bytes(infile, &in[nbytes], to_read);
+            eof = num_read < to_read;
+            nbytes += num_read;
+        }
+
+        uint64_t nbits = nbytes * 8;
+        uint64_t limit = eof ? nbits : nbits - MAX_CODE_SIZE * 8;
+        uint64_t want = h->file_size - decoded < BLOCK ? h->file_size - decoded : BLOCK;
+        uint64_t n = kernel.decode(&c->decoder->table, in, nbits, &pos, limit, out, want);
+        write_bytes(outfile, out, n);
+        decoded += n;
+        if (eof && !n) {
+            break; // Truncated input
+        }
+    }
+    return decoded == h->file_size;
+}
+
+// Map the payload and split it between threads. Output is buffered whole,
+// so a header claiming more symbols than the payload has bits is decoded
+// serially instead of sizing the buffer from it.
+bool decode_parallel(Codec *c, int infile, int outfile, Header *h, uint64_t size) {
+    uint64_t offset = sizeof(Header) + h->tree_size;
+    uint64_t nbits = size > offset ? (size - offset) * 8 : 0;
+    uint8_t *map = (uint8_t *) MAP_FAILED;
+    if (h->file_size <= nbits) {
+        map = (uint8_t *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, infile, 0);
+    }
+    if (map == MAP_FAILED) {
+        return decode_serial(c, infile, outfile, h);
+    }
+    uint8_t *out = (uint8_t *) place_alloc(h->file_size + 1);
+    if (!out) {
+        munmap(map, size);
+        return decode_serial(c, infile, outfile, h);
+    }
+    uint64_t n = parallel_decode(&c->decoder->table, map + offset, nbits, out, h->file_size, c->threads, c->nodes);
+    bytes_read = size;
+
+    // write_bytes() takes an int, so write in bounded chunks
+    for (uint64_t i = 0; i < n; i += 1 << 30) {
+        uint64_t chunk = n - i < (1 << 30) ? n - i : (1 << 30);
+        write_bytes(outfile, &out[i], chunk);
+    }
+    place_free(out, h->file_size + 1);
+    munmap(map, size);
+    return n == h->file_size;
+}
+
+// Decode blocks until the end block or file_size bytes. Output is gathered
+// in raw and written when full or at a sync block. Input that ends before
+// either, or an end block before file_size bytes of a known size, fails.
+bool decode_blocks(Codec *c, int infile, int outfile, Header *h) {
+    uint64_t decoded = 0;
+    uint32_t fill = 0;
+    bool ok = true;
+    bool ended = false;
+    BlockHeader bh;
+    c->decoder->table.root = NULL;
+    while (decoded < h->file_size && read_bytes(infile, (uint8_t *) &bh, sizeof(bh)) == sizeof(bh)) {
+        if (bh.type == BLOCK_END) {
+            ended = true;
+            break;
+        }
+        if (bh.type != BLOCK_SYNC && !block_valid(&bh)) {
+            fprintf(stderr, "Error: corrupt block\n");
+            ok = false;
+            break;
+        }
+        if (bh.type == BLOCK_SYNC || fill + bh.raw_size > MAX_BLOCK) {
+            write_bytes(outfile, c->raw, fill);
+            fill = 0;
+        }
+        if (bh.type == BLOCK_SYNC) {
+            continue;
+        }
+        uint32_t size = block_extra(&bh) + bh.tree_size + bh.payload_size;
+        if (read_bytes(infile, c->payload, size) != (int) size
+            || !decode_block(&bh, c->payload, c->decoder, &c->raw[fill])) {
+            fprintf(stderr, "Error: corrupt block\n");
+            ok = false;
+            break;
+        }
+        fill += bh.raw_size;
+        decoded += bh.raw_size;
+    }
+    write_bytes(outfile, c->raw, fill);
+    if (ok && decoded < h->file_size && (!ended || h->file_size != UINT64_MAX)) {
+        fprintf(stderr, "Error: truncated input\n");
+        ok = false;
+    }
+    return ok;
+}
+
+bool decode_file(Codec *c, int infile, int outfile) {
+    io_reset();
+
+    // Read in header and check magic number
+    Header h;
+    if (read_bytes(infile, (uint8_t *) &h, sizeof(Header)) != sizeof(Header)) {
+        fprintf(stderr, "Error: invalid file header\n");
+        return false;
+    }
+    // Only permission bits, never setuid or setgid from the input
+    h.permissions &= 0777;
+    if (h.magic == MAGIC_BLOCKS && h.tree_size == 0) {
+        fchmod(outfile, h.permissions);
+        bool ok = decode_blocks(c, infile, outfile, &h);
+        c->compressed = bytes_read;
+        c->uncompressed = bytes_written;
+        return ok;
+    }
+    if (h.magic != MAGIC) {
+        fprintf(stderr, "Error: invalid file header\n");
+        return false;
+    }
+
+    // Set outfile perms from header
+    fchmod(outfile, h.permissions);
+
+    // Rebuild tree, bounded by MAX_TREE_SIZE and checked for shape
+    if (h.tree_size > MAX_TREE_SIZE || read_bytes(infile, c->payload, h.tree_size) != h.tree_size
+        || !table_load(&c->decoder->table, h.tree_size, c->payload)) {
+        fprintf(stderr, "Error: invalid tree\n");
+        return false;
+    }
+
+    // Speculative parallel decode needs random access to the whole bitstream
+    struct stat statbuf;
+    fstat(infile, &statbuf);
+    bool ok;
+    if (c->threads > 1 && S_ISREG(statbuf.st_mode)) {
+        ok = decode_parallel(c, infile, outfile, &h, statbuf.st_size);
+    } else {
+        ok = decode_serial(c, infile, outfile, &h);
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: truncated input\n");
+    }
+
+    c->compressed = bytes_read;
+    c->uncompressed = bytes_written;
+    c->decoder->table.root = NULL;
+    return ok;
+}
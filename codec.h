@@ -0,0 +1,52 @@
+#ifndef __CODEC_H__
+#define __CODEC_H__
+
+#include "block.h"
+#include "index.h"
+#include "place.h"
+#include "table.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SYNC_INTERVAL 100 // Default longest wait between streaming sync blocks, in ms.
+
+// Per-caller state, kept warm between requests
+typedef struct Codec {
+    uint32_t threads; // Decode threads.
+    bool blocks; // Encode in the block format.
+    bool streaming; // Sync whenever the input has no data ready.
+    uint32_t interval; // And at least this often while it keeps coming, in ms.
+    uint32_t effort; // Block splitting effort, 0 for fixed-size blocks.
+    uint32_t block_size; // Largest block, at most MAX_BLOCK.
+    BlockDecoder *decoder; // Decode tables and scratch, reused per file.
+    uint8_t *raw; // MAX_BLOCK bytes of uncompressed data.
+    uint32_t pending; // Bytes in raw not yet coded.
+    uint8_t *payload; // A block's tree dump and codes.
+    BlockState state; // Table reused by repeat blocks.
+    Index *index; // Blocks written so far.
+    uint64_t base; // Output file offset where bytes_written was 0.
+    uint64_t uncompressed; // Sizes of the last request.
+    uint64_t compressed;
+    NodeStats nodes[PLACE_NODES]; // Parallel decode work per node, cumulative.
+} Codec;
+
+Codec *codec_create(uint32_t threads);
+
+void codec_delete(Codec **c);
+
+void stream_begin(Codec *c, int outfile, uint16_t permissions, uint64_t file_size);
+
+bool stream_write(Codec *c, int outfile, const uint8_t *buf, uint32_t n);
+
+bool stream_flush(Codec *c, int outfile);
+
+bool stream_end(Codec *c, int outfile);
+
+bool encode_file(Codec *c, int infile, int outfile);
+
+bool append_file(Codec *c, int infile, int outfile);
+
+bool decode_file(Codec *c, int infile, int outfile);
+
+#endif
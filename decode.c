@@ -1,10 +1,21 @@
+#include "block.c"
+#include "bwt.c"
 #include "code.c"
+#include "codec.c"
 #include "header.h"
 #include "huffman.c"
+#include "index.c"
 #include "io.c"
+#include "kernel.c"
 #include "node.c"
+#include "parallel.c"
+#include "place.c"
 #include "pq.c"
+#include "search.c"
 #include "stack.c"
+#include "table.c"
+#include "tans.c"
+#include "wide.c"
 
 #include <assert.h>
 #include <errno.h>
@@ -15,17 +26,30 @@
 #include <stdint.h>
 #include <stdio.h> // only use for printf, else use io.c
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-#define OPTIONS "hvi:o:"
+#define OPTIONS "hvpHg:k:i:o:t:"
 
 void print_help(char *path);
 int check_open(int fd, char *filename);
+void print_match(void *arg, uint64_t offset, const uint8_t *line, uint32_t len);
+
+// Matching lines written as "offset:line", buffered for write_bytes()
+typedef struct Matches {
+    int outfile;
+    uint64_t count;
+    uint32_t n;
+    uint8_t buf[2 * SEARCH_LINE];
+} Matches;
 
 int main(int argc, char **argv) {
     bool verbose = false;
+    bool forced = false;
+    char *pattern = NULL;
+    uint32_t threads = 1;
     int infile = STDIN_FILENO;
     int outfile = STDOUT_FILENO;
 
@@ -35,6 +59,17 @@ int main(int argc, char **argv) {
         switch (opt) {
         case 'h': print_help(argv[0]); return EXIT_SUCCESS;
         case 'v': verbose = true; break;
+        case 'k':
+            if (!kernel_select(optarg)) {
+                fprintf(stderr, "Error: kernel %s is not supported.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            forced = true;
+            break;
+        case 't': threads = strtoul(optarg, NULL, 10); break;
+        case 'p': placement.pin = true; break;
+        case 'H': placement.huge = true; break;
+        case 'g': pattern = optarg; break;
         case 'i':
             infile = open(optarg, O_RDONLY); 
             if (check_open(infile, optarg)) { // returns 1 for error
@@ -53,61 +88,59 @@ int main(int argc, char **argv) {
         }
     }
 
-    // Read in header and check magic number
-    Header h;
-    read_bytes(infile, (uint8_t *) &h, sizeof(Header));
-    if (h.magic != MAGIC) {
-        fprintf(stderr, "Error: invalid file header\n");
-        return EXIT_FAILURE;
+    if (!forced) {
+        kernel_select("auto");
     }
 
-    // Set outfile perms from header
-    fchmod(outfile, h.permissions);
-
-    // Rebuild tree
-    uint8_t read_tree[h.tree_size];
-    read_bytes(infile, read_tree, h.tree_size);
-    Node *root = rebuild_tree(h.tree_size, read_tree);
-
-    // Read infile with read_bit and write symbols to outfile
-    uint8_t bit = 0;
-    uint8_t buffer[BLOCK];
-    int idx = 0;
-    Node *curr = root;
-    while (bytes_written < h.file_size && read_bit(infile, &bit)) {
-        if (bit == 0x0 && curr->left) {
-            curr = curr->left;
-        } else if (bit == 0x1 && curr->right) {
-            curr = curr->right;
+    Codec *c = codec_create(threads);
+    if (pattern) {
+        Matches *m = (Matches *) malloc(sizeof(Matches));
+        if (!c || !m) {
+            fprintf(stderr, "Error: not enough memory to search\n");
+            free(m);
+            codec_delete(&c);
+            return EXIT_FAILURE;
         }
-        if (!curr->left && !curr->right) { // Found leaf
-            buffer[idx] = curr->symbol;
-            idx++;
-            if (idx == BLOCK) { // buffer is full
-                write_bytes(outfile, buffer, BLOCK);
-                idx = 0;
-            }
-            curr = root;
+        m->outfile = outfile;
+        m->count = 0;
+        m->n = 0;
+        bool ok = search_file(c, infile, (uint8_t *) pattern, strlen(pattern), print_match, m);
+        write_bytes(outfile, m->buf, m->n);
+        if (verbose) {
+            fprintf(stderr, "Compressed file size: %" PRIu64 " bytes\n", c->compressed);
+            fprintf(stderr, "Searched size: %" PRIu64 " bytes\n", c->uncompressed);
+            fprintf(stderr, "Matching lines: %" PRIu64 "\n", m->count);
         }
+        free(m);
+        codec_delete(&c);
+        close(infile);
+        close(outfile);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
     }
-
-    // Flush any remaining bytes in buffer
-    uint64_t remaining = h.file_size - bytes_written;
-    if (remaining) {
-        write_bytes(outfile, buffer, remaining); 
+    if (!decode_file(c, infile, outfile)) {
+        codec_delete(&c);
+        return EXIT_FAILURE;
     }
 
     // Print compression stats
     if (verbose) {
-        uint64_t comp = bytes_read; // compressed size
-        uint64_t decomp = bytes_written; // uncompressed size
+        uint64_t comp = c->compressed; // compressed size
+        uint64_t decomp = c->uncompressed; // uncompressed size
         fprintf(stderr, "Compressed file size: %" PRIu64 " bytes\n", comp);
         fprintf(stderr, "Decompressed file size: %" PRIu64 " bytes\n", decomp);
         double space_saving = 100.0 * (1.0 - (comp / (double) decomp));
         fprintf(stderr, "Space saving: %.2f%%\n", space_saving);
+        fprintf(stderr, "Kernel: %s\n", kernel.name);
+        for (uint32_t n = 0; n < PLACE_NODES; n++) {
+            NodeStats *ns = &c->nodes[n];
+            if (ns->tasks) {
+                fprintf(stderr, "Node %" PRIu32 ": %" PRIu64 " threads, %.1f MB/s\n", n, ns->tasks,
+                    ns->ns ? ns->bytes * 1e3 / ns->ns : 0);
+            }
+        }
     }
 
-    delete_tree(&root);
+    codec_delete(&c);
     close(infile);
     close(outfile);
     return EXIT_SUCCESS;
@@ -117,14 +150,32 @@ void print_help(char *path) {
     printf("SYNOPSIS\n");
     printf("  A decoder for Huffman compression.\n\n");
     printf("USAGE\n");
-    printf("  %s [-h] [-v] [-i infile] [-o outfile]\n\n", path);
+    printf("  %s [-h] [-v] [-p] [-H] [-g pattern] [-k kernel] [-t threads] [-i infile] [-o outfile]\n\n", path);
     printf("OPTIONS\n");
     printf("  -%-14s Program usage and help.\n", "h");
     printf("  -%-14s Print decompression statistics to stderr.\n", "v");
+    printf("  -%-14s Decode with speculative threads (default: 1).\n", "t threads");
+    printf("  -%-14s Print offset:line for lines containing pattern instead.\n", "g pattern");
+    printf("  -%-14s Pin decode threads to CPUs, spread across NUMA nodes.\n", "p");
+    printf("  -%-14s Back decode buffers with huge pages.\n", "H");
+    printf("  -%-14s Force scalar, bmi2 or avx2 kernel (default: auto).\n", "k kernel");
     printf("  -%-14s Specify input file to decompress.\n", "i infile");
     printf("  -%-14s Specify output file for decompresed file.\n", "o outfile");
 }
 
+void print_match(void *arg, uint64_t offset, const uint8_t *line, uint32_t len) {
+    Matches *m = (Matches *) arg;
+    if (m->n + len + 32 > sizeof(m->buf)) {
+        write_bytes(m->outfile, m->buf, m->n);
+        m->n = 0;
+    }
+    m->n += snprintf((char *) &m->buf[m->n], 32, "%" PRIu64 ":", offset);
+    memcpy(&m->buf[m->n], line, len);
+    m->n += len;
+    m->buf[m->n++] = '\n';
+    m->count++;
+}
+
 //  Return 1 on error 
 int check_open(int fd, char *filename) {
     if (errno == EACCES) {
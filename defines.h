@@ -4,7 +4,10 @@
 #define BLOCK         4096 // 4KB blocks.
 #define ALPHABET      256 // ASCII + Extended ASCII.
 #define MAGIC         0xDEADBEEF // 32-bit magic number.
+#define MAGIC_BLOCKS  0xDEADBEEB // Magic number for the block format.
+#define MAX_BLOCK     (1 << 20) // 1MB maximum block size.
 #define MAX_CODE_SIZE (ALPHABET / 8) // Bytes for a maximum, 256-bit code.
 #define MAX_TREE_SIZE (3 * ALPHABET - 1) // Maximum Huffman tree dump size.
+#define MAX_NODES     (2 * ALPHABET - 1) // Nodes in a full Huffman tree.
 
 #endif
@@ -1,11 +1,21 @@
+#include "block.c"
+#include "bwt.c"
 #include "code.c"
+#include "codec.c"
 #include "defines.h"
 #include "header.h"
 #include "huffman.c"
+#include "index.c"
 #include "io.c"
+#include "kernel.c"
 #include "node.c"
+#include "parallel.c"
+#include "place.c"
 #include "pq.c"
 #include "stack.c"
+#include "table.c"
+#include "tans.c"
+#include "wide.c"
 
 #include <assert.h>
 #include <errno.h>
@@ -16,26 +26,31 @@
 #include <stdint.h>
 #include <stdio.h> // only use for printf, else use io.c
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-#define OPTIONS "hvi:o:"
+#define OPTIONS "hvabB:sf:TwF:e:k:i:o:"
 
 void print_help(char *path);
 int check_open(int fd, char *filename);
 
-void prep_hist(uint64_t *hist);
-void fill_hist(int infile, uint64_t *hist);
-
-Header make_header(int infile, uint64_t *hist);
-
-void tree_dump(char *buf, Node *root);
-
 int main(int argc, char **argv) {
     bool verbose = false;
+    bool forced = false;
+    bool blocks = false;
+    bool append = false;
+    bool streaming = false;
+    uint32_t interval = SYNC_INTERVAL;
+    bool bwt = false;
+    bool wide = false;
+    uint8_t stride = 0;
+    uint32_t effort = 0;
+    uint32_t block_size = MAX_BLOCK;
     int infile = STDIN_FILENO;
     int outfile = STDOUT_FILENO;
+    char *outname = NULL;
 
     // Parse options
     int opt;
@@ -43,6 +58,53 @@ int main(int argc, char **argv) {
         switch (opt) {
         case 'h': print_help(argv[0]); return EXIT_SUCCESS;
         case 'v': verbose = true; break;
+        case 'a': append = true; break;
+        case 'b': blocks = true; break;
+        case 'B':
+            blocks = true;
+            block_size = strtoul(optarg, NULL, 10);
+            if (!block_size || block_size > MAX_BLOCK) {
+                fprintf(stderr, "Error: block size must be 1 to %d bytes.\n", MAX_BLOCK);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's':
+            blocks = true;
+            streaming = true;
+            break;
+        case 'f':
+            blocks = true;
+            streaming = true;
+            interval = strtoul(optarg, NULL, 10);
+            break;
+        case 'T':
+            blocks = true;
+            bwt = true;
+            break;
+        case 'w':
+            blocks = true;
+            wide = true;
+            break;
+        case 'F':
+            blocks = true;
+            stride = strtoul(optarg, NULL, 10) <= MAX_STRIDE ? strtoul(optarg, NULL, 10) : 0;
+            stride = !strcmp(optarg, "auto") ? STRIDE_AUTO : stride;
+            if (!stride || (stride & (stride - 1) && stride != STRIDE_AUTO)) {
+                fprintf(stderr, "Error: stride must be auto or a power of two up to %d.\n", MAX_STRIDE);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'e':
+            blocks = true;
+            effort = strtoul(optarg, NULL, 10);
+            break;
+        case 'k':
+            if (!kernel_select(optarg)) {
+                fprintf(stderr, "Error: kernel %s is not supported.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            forced = true;
+            break;
         case 'i':
             infile = open(optarg, O_RDONLY); 
             if (check_open(infile, optarg)) { 
@@ -50,132 +112,87 @@ int main(int argc, char **argv) {
                 return EXIT_FAILURE;
             }
             break;
-        case 'o':
-            outfile = open(optarg, O_WRONLY | O_CREAT | O_TRUNC);
-            if (check_open(outfile, optarg)) {
-                close(infile);
-                return EXIT_FAILURE;
-            }
-            break;
+        case 'o': outname = optarg; break;
         default: print_help(argv[0]); return EXIT_SUCCESS;
         }
     }
 
-    // Construct histogram
-    uint64_t hist[ALPHABET];
-    prep_hist(hist); //zeroes and adds min values
-    fill_hist(infile, hist);
-
-    // Construct Huffman tree and build code table
-    Node *root = build_tree(hist);
-    Code table[ALPHABET];
-    build_codes(root, table);
-
-    // Construct header and set perms in outfile, then write to outfile
-    Header h = make_header(infile, hist);
-    assert(fchmod(outfile, h.permissions) != -1);
-    write_bytes(outfile, (uint8_t *) &h, sizeof(h));
+    // Appending keeps the existing contents, so open once all flags are known
+    if (append && !outname) {
+        fprintf(stderr, "Error: appending needs an output file.\n");
+        return EXIT_FAILURE;
+    }
+    if (outname) {
+        outfile = open(outname, append ? O_RDWR | O_CREAT : O_WRONLY | O_CREAT | O_TRUNC);
+        if (check_open(outfile, outname)) {
+            close(infile);
+            return EXIT_FAILURE;
+        }
+    }
 
-    // Write tree to outfile (post-order traversal)
-    char dump[h.tree_size];
-    tree_dump(dump, root);
-    write_bytes(outfile, (uint8_t *) dump, h.tree_size);
+    if (!forced) {
+        kernel_select("auto");
+    }
 
-    // Write code for each symbol in infile then flush_codes
-    lseek(infile, 0, SEEK_SET); //reset position in infile (from hist fill)
-    uint8_t buf[BLOCK];
-    int num_read = 0;
-    while ((num_read = read_bytes(infile, buf, BLOCK)) != 0) {
-        for (int i = 0; i < num_read; i++) {
-            write_code(outfile, &table[buf[i]]);
-        }
+    Codec *c = codec_create(1);
+    if (!c) {
+        fprintf(stderr, "Error: not enough memory for the encoder\n");
+        close(infile);
+        close(outfile);
+        return EXIT_FAILURE;
     }
-    flush_codes(outfile);
+    c->blocks = blocks;
+    c->streaming = streaming;
+    c->interval = interval;
+    c->effort = effort;
+    c->block_size = block_size;
+    c->state.bwt = bwt;
+    c->state.wide = wide ? wide_create() : NULL;
+    c->state.stride = stride;
+    if (wide && !c->state.wide) {
+        fprintf(stderr, "Error: not enough memory for 16-bit symbols\n");
+        codec_delete(&c);
+        close(infile);
+        close(outfile);
+        return EXIT_FAILURE;
+    }
+    bool ok = append ? append_file(c, infile, outfile) : encode_file(c, infile, outfile);
 
     // Print compression stats
-    if (verbose) {
-        uint64_t unc = h.file_size; // uncompressed
-        uint64_t comp = bytes_written; // compressed (extern from io)
+    if (verbose && ok) {
+        uint64_t unc = c->uncompressed;
+        uint64_t comp = c->compressed;
         fprintf(stderr, "Uncompressed file size: %" PRIu64 " bytes\n", unc);
         fprintf(stderr, "Compressed file size: %" PRIu64 " bytes\n", comp);
         double space_saving = 100.0 * (1.0 - (comp / (double) unc));
         fprintf(stderr, "Space saving: %.2f%%\n", space_saving);
+        fprintf(stderr, "Kernel: %s\n", kernel.name);
     }
 
-    delete_tree(&root);
+    codec_delete(&c);
     close(infile);
     close(outfile);
-    return EXIT_SUCCESS;
-}
-
-// zeroes histogram and adds min values
-void prep_hist(uint64_t *hist) {
-    for (int i = 0; i < ALPHABET; i++) {
-        hist[i] = 0;
-    }
-    hist[0] = 1;
-    hist[255] = 1;
-}
-
-void fill_hist(int infile, uint64_t *hist) {
-    uint8_t buffer[BLOCK];
-    int num_read = 0;
-    while ((num_read = read_bytes(infile, buffer, BLOCK)) != 0) {
-        for (int i = 0; i < num_read; i++) {
-            hist[buffer[i]]++;
-        }
-    }
-}
-
-// Fills header with information, hist to count tree size
-Header make_header(int infile, uint64_t *hist) {
-    Header h;
-    h.magic = MAGIC;
-
-    struct stat statbuf; 
-    assert(fstat(infile, &statbuf) != -1);
-    h.permissions = statbuf.st_mode;
-
-    h.tree_size = 0;
-    // Tree size = 3x(unique symbols)-1
-    for (int i = 0; i < ALPHABET; i++) {
-        if (hist[i] != 0) {
-            h.tree_size += 3;
-        }
-    }
-    h.tree_size--;
-    h.file_size = statbuf.st_size;
-    return h;
-}
-
-// Fill buffer with symbolic huffman tree from post-order traversal
-void tree_dump(char *buf, Node *root) {
-    static int idx;
-    if (root->left) {
-        tree_dump(buf, root->left);
-    }
-    if (root->right) {
-        tree_dump(buf, root->right);
-    }
-
-    if (!root->left && !root->right) { // leaf
-        buf[idx] = 'L';
-        buf[idx + 1] = root->symbol;
-        idx += 2;
-    } else { // interior
-        buf[idx] = 'I';
-        idx++;
-    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 void print_help(char *path) {
     printf("SYNOPSIS\n");
     printf("  An encoder for Huffman compression.\n\n");
     printf("USAGE\n");
-    printf("  %s [-h] [-v] [-i infile] [-o outfile]\n\n", path);
+    printf("  %s [-h] [-v] [-a] [-b] [-B size] [-s] [-f ms] [-T] [-w] [-F stride] [-e effort] [-k kernel] [-i infile] [-o outfile]\n\n", path);
     printf("OPTIONS\n");
     printf("  -%-14s Program usage and help.\n", "h");
     printf("  -%-14s Print compression statistics to stderr.\n", "v");
+    printf("  -%-14s Append to the block format output file.\n", "a");
+    printf("  -%-14s Use the block format with fixed-size blocks.\n", "b");
+    printf("  -%-14s Block format with blocks of up to size bytes.\n", "B size");
+    printf("  -%-14s Block format, sync whenever input is caught up.\n", "s");
+    printf("  -%-14s Streaming, also sync every ms of busy input (default: %d).\n", "f ms", SYNC_INTERVAL);
+    printf("  -%-14s Block format, BWT and move-to-front each block.\n", "T");
+    printf("  -%-14s Block format, try 16-bit symbols per block.\n", "w");
+    printf("  -%-14s Block format, delta prefilter (auto, 1-16).\n", "F stride");
+    printf("  -%-14s Block format, split blocks adaptively (1-9).\n", "e effort");
+    printf("  -%-14s Force scalar, bmi2 or avx2 kernel (default: auto).\n", "k kernel");
     printf("  -%-14s Specify input file to compress.\n", "i infile");
     printf("  -%-14s Specify output file for compressed file.\n", "o outfile");
 }
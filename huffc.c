@@ -0,0 +1,197 @@
+#include "block.h"
+#include "defines.h"
+#include "ipc.c"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h> // only use for printf, else use io.c
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define OPTIONS "hvdSbB:e:TwF:t:s:i:o:"
+
+void print_help(char *path);
+int check_open(int fd, char *filename);
+void print_stats(Stats *s);
+
+int main(int argc, char **argv) {
+    bool verbose = false;
+    bool stats = false;
+    Request req = { .op = OP_ENCODE };
+    char *path = DAEMON_SOCKET;
+    int infile = STDIN_FILENO;
+    int outfile = STDOUT_FILENO;
+
+    // Parse options, same as the encode and decode programs
+    int opt;
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'h': print_help(argv[0]); return EXIT_SUCCESS;
+        case 'v': verbose = true; break;
+        case 'd': req.op = OP_DECODE; break;
+        case 'b': req.blocks = true; break;
+        case 'B':
+            req.blocks = true;
+            req.block_size = strtoul(optarg, NULL, 10);
+            if (!req.block_size || req.block_size > MAX_BLOCK) {
+                fprintf(stderr, "Error: block size must be 1 to %d bytes.\n", MAX_BLOCK);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'e':
+            req.blocks = true;
+            req.effort = strtoul(optarg, NULL, 10);
+            break;
+        case 'T':
+            req.blocks = true;
+            req.bwt = true;
+            break;
+        case 'w':
+            req.blocks = true;
+            req.wide = true;
+            break;
+        case 'F':
+            req.blocks = true;
+            req.stride = strtoul(optarg, NULL, 10) <= MAX_STRIDE ? strtoul(optarg, NULL, 10) : 0;
+            req.stride = !strcmp(optarg, "auto") ? STRIDE_AUTO : req.stride;
+            if (!req.stride || (req.stride & (req.stride - 1) && req.stride != STRIDE_AUTO)) {
+                fprintf(stderr, "Error: stride must be auto or a power of two up to %d.\n", MAX_STRIDE);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't': req.threads = strtoul(optarg, NULL, 10); break;
+        case 'S': stats = true; break;
+        case 's': path = optarg; break;
+        case 'i':
+            infile = open(optarg, O_RDONLY);
+            if (check_open(infile, optarg)) {
+                close(outfile);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'o':
+            outfile = open(optarg, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+            if (check_open(outfile, optarg)) {
+                close(infile);
+                return EXIT_FAILURE;
+            }
+            break;
+        default: print_help(argv[0]); return EXIT_SUCCESS;
+        }
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (sock < 0 || connect(sock, (struct sockaddr *) &addr, sizeof(addr))) {
+        fprintf(stderr, "Error: could not connect to %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (stats) {
+        Request query = { .op = OP_STATS };
+        Stats s;
+        if (!send_msg(sock, &query, sizeof(query), NULL, 0) || !recv_msg(sock, &s, sizeof(s), NULL, 0)) {
+            fprintf(stderr, "Error: no response from daemon\n");
+            return EXIT_FAILURE;
+        }
+        print_stats(&s);
+        close(sock);
+        return EXIT_SUCCESS;
+    }
+
+    // The daemon works on our descriptors directly, no data is copied
+    Response res;
+    int fds[2] = { infile, outfile };
+    if (!send_msg(sock, &req, sizeof(req), fds, 2) || !recv_msg(sock, &res, sizeof(res), NULL, 0)) {
+        fprintf(stderr, "Error: no response from daemon\n");
+        return EXIT_FAILURE;
+    }
+    if (res.status) {
+        fprintf(stderr, "Error: daemon could not %s input\n", req.op == OP_ENCODE ? "compress" : "decompress");
+        return EXIT_FAILURE;
+    }
+
+    if (verbose) {
+        fprintf(stderr, "Uncompressed file size: %" PRIu64 " bytes\n", res.uncompressed);
+        fprintf(stderr, "Compressed file size: %" PRIu64 " bytes\n", res.compressed);
+        double space_saving = 100.0 * (1.0 - (res.compressed / (double) res.uncompressed));
+        fprintf(stderr, "Space saving: %.2f%%\n", space_saving);
+        fprintf(stderr, "Latency: %.3f ms\n", res.latency_ns / 1e6);
+    }
+
+    close(sock);
+    close(infile);
+    close(outfile);
+    return EXIT_SUCCESS;
+}
+
+// Latency histograms, one row per non-empty power of two bucket, then
+// uncompressed bytes per second of request time on each NUMA node. Request
+// times are summed, so concurrent workers on a node are not added up.
+void print_stats(Stats *s) {
+    const char *names[2] = { "encode", "decode" };
+    uint64_t *hists[2] = { s->encode, s->decode };
+    for (int h = 0; h < 2; h++) {
+        printf("%s latency:\n", names[h]);
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            if (hists[h][b]) {
+                printf("  < %10" PRIu64 " us: %" PRIu64 "\n", (uint64_t) 2 << b, hists[h][b]);
+            }
+        }
+    }
+    printf("node throughput:\n");
+    for (int n = 0; n < PLACE_NODES; n++) {
+        NodeStats *ns = &s->nodes[n];
+        if (ns->tasks) {
+            double mbps = ns->ns ? ns->bytes * 1e3 / ns->ns : 0;
+            printf("  node %2d: %" PRIu64 " requests, %" PRIu64 " bytes, %.1f MB/s per worker\n", n, ns->tasks, ns->bytes, mbps);
+        }
+    }
+}
+
+void print_help(char *path) {
+    printf("SYNOPSIS\n");
+    printf("  A client for the Huffman compression daemon.\n\n");
+    printf("USAGE\n");
+    printf("  %s [-h] [-v] [-d] [-S] [-b] [-B size] [-e effort] [-T] [-w] [-F stride] [-t threads] [-s socket] [-i infile] [-o outfile]\n\n", path);
+    printf("OPTIONS\n");
+    printf("  -%-14s Program usage and help.\n", "h");
+    printf("  -%-14s Print compression statistics to stderr.\n", "v");
+    printf("  -%-14s Decompress instead of compress.\n", "d");
+    printf("  -%-14s Block format, as for encode (also -B, -e, -T, -w, -F).\n", "b");
+    printf("  -%-14s Largest block, at most %d bytes.\n", "B size", MAX_BLOCK);
+    printf("  -%-14s Adaptive block splitting effort 1-9.\n", "e effort");
+    printf("  -%-14s Burrows-Wheeler transform each block.\n", "T");
+    printf("  -%-14s Try 16-bit symbols per block.\n", "w");
+    printf("  -%-14s Delta prefilter stride, 1-16 or auto.\n", "F stride");
+    printf("  -%-14s Decode threads (default: the daemon's -t).\n", "t threads");
+    printf("  -%-14s Print the daemon's latency histograms.\n", "S");
+    printf("  -%-14s Socket path (default: %s).\n", "s socket", DAEMON_SOCKET);
+    printf("  -%-14s Specify input file.\n", "i infile");
+    printf("  -%-14s Specify output file.\n", "o outfile");
+}
+
+// returns non-zero if fd is an error code
+int check_open(int fd, char *filename) {
+    if (errno == EACCES) {
+        fprintf(stderr, "Error: File %s cannot be accessed.\n", filename);
+        return 1; // Error
+    } else if (errno == ENOENT) {
+        fprintf(stderr, "Error: File %s does not exist.\n", filename);
+        return 1;
+    } else if (fd < 0) {
+        fprintf(stderr, "Error: Could not open file %s\n", filename);
+        return 1;
+    }
+    return 0; // OK
+}
@@ -0,0 +1,333 @@
+#include "block.c"
+#include "bwt.c"
+#include "code.c"
+#include "codec.c"
+#include "huffman.c"
+#include "index.c"
+#include "io.c"
+#include "ipc.c"
+#include "kernel.c"
+#include "node.c"
+#include "parallel.c"
+#include "place.c"
+#include "pq.c"
+#include "stack.c"
+#include "table.c"
+#include "tans.c"
+#include "wide.c"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h> // only use for printf, else use io.c
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OPTIONS "hs:w:t:pH"
+#define BACKLOG 128 // Pending connections before accept.
+#define CLIENTS 1024 // Open connections, idle ones wait in poll().
+#define THREADS 64 // Most decode threads a request may ask for.
+#define TIMEOUT 5 // Seconds the rest of a request may take once it starts.
+
+void print_help(char *path);
+
+// Connections with a request ready, waiting for a worker
+static int queue[BACKLOG];
+static uint32_t head, tail, queued;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready = PTHREAD_COND_INITIALIZER;
+
+// Connections handed back by workers after one request, and the pipe that
+// wakes the main thread's poll() for them
+static int returned[CLIENTS];
+static uint32_t nreturned;
+static uint32_t clients; // Open connections, wherever they are.
+static int wake[2];
+
+static Stats stats;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t threads = 1; // Decode threads per request
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Removes a stale socket left at path by a daemon that exited. Fails if a
+// daemon still answers there or path is not a socket.
+static bool claim_socket(const char *path) {
+    struct stat st;
+    if (lstat(path, &st)) {
+        return errno == ENOENT;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "Error: %s exists and is not a socket\n", path);
+        return false;
+    }
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    bool live = probe >= 0 && !connect(probe, (struct sockaddr *) &addr, sizeof(addr));
+    if (probe >= 0) {
+        close(probe);
+    }
+    if (live) {
+        fprintf(stderr, "Error: a daemon is already listening on %s\n", path);
+        return false;
+    }
+    return !unlink(path) || errno == ENOENT;
+}
+
+// Applies a request's settings to the worker's codec, false if they are
+// invalid. The wide coder is created on first use and kept in *wide.
+static bool configure(Codec *c, WideCoder **wide, Request *req) {
+    bool power = req->stride && !(req->stride & (req->stride - 1));
+    if (req->block_size > MAX_BLOCK || (req->stride && req->stride != STRIDE_AUTO && (!power || req->stride > MAX_STRIDE))) {
+        return false;
+    }
+    if (req->wide && !*wide) {
+        *wide = wide_create();
+        if (!*wide) {
+            return false;
+        }
+    }
+    c->blocks = req->blocks;
+    c->block_size = req->block_size ? req->block_size : MAX_BLOCK;
+    c->effort = req->effort;
+    c->state.bwt = req->bwt;
+    c->state.wide = req->wide ? *wide : NULL;
+    c->state.stride = req->stride;
+    c->threads = !req->threads ? threads : req->threads < THREADS ? req->threads : THREADS;
+    return true;
+}
+
+static void close_fds(int *fds, int nfds) {
+    for (int i = 0; i < nfds; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+}
+
+// Serves one request on a connection, false once the client hung up or
+// sent only part of a request. Without a codec every encode or decode
+// request fails.
+static bool serve(Codec *c, WideCoder **wide, int conn) {
+    Request req;
+    int fds[2];
+    if (!recv_msg(conn, &req, sizeof(req), fds, 2)) {
+        return false;
+    }
+    if (req.op == OP_STATS) {
+        close_fds(fds, 2);
+        pthread_mutex_lock(&stats_lock);
+        Stats snapshot = stats;
+        pthread_mutex_unlock(&stats_lock);
+        return send_msg(conn, &snapshot, sizeof(snapshot), NULL, 0);
+    }
+
+    Response res = { .status = -1 };
+    if (c && fds[0] >= 0 && fds[1] >= 0 && (req.op == OP_ENCODE || req.op == OP_DECODE) && configure(c, wide, &req)) {
+        uint64_t start = now_ns();
+        bool ok = req.op == OP_ENCODE ? encode_file(c, fds[0], fds[1]) : decode_file(c, fds[0], fds[1]);
+        res.latency_ns = now_ns() - start;
+        res.status = ok ? 0 : -1;
+        res.uncompressed = c->uncompressed;
+        res.compressed = c->compressed;
+
+        // Unpinned workers may migrate, count the node they finished on
+        uint32_t node = place_node();
+        pthread_mutex_lock(&stats_lock);
+        uint64_t *hist = req.op == OP_ENCODE ? stats.encode : stats.decode;
+        hist[latency_bucket(res.latency_ns)]++;
+        stats.nodes[node].tasks++;
+        stats.nodes[node].bytes += res.uncompressed;
+        stats.nodes[node].ns += res.latency_ns;
+        pthread_mutex_unlock(&stats_lock);
+    }
+    close_fds(fds, 2);
+    return send_msg(conn, &res, sizeof(res), NULL, 0);
+}
+
+// Each worker keeps its own warm codec and thread-local io buffers. It is
+// placed first, so the codec's buffers are mapped on its node.
+static void *worker(void *arg) {
+    place_thread((uint32_t) (uintptr_t) arg);
+    Codec *c = codec_create(threads);
+    WideCoder *wide = NULL; // Lent to c->state for -w requests
+    if (!c) {
+        fprintf(stderr, "Error: worker could not allocate its codec\n");
+    }
+    while (true) {
+        pthread_mutex_lock(&lock);
+        while (!queued) {
+            pthread_cond_wait(&ready, &lock);
+        }
+        int conn = queue[head];
+        head = (head + 1) % BACKLOG;
+        queued--;
+        pthread_mutex_unlock(&lock);
+
+        // Hand the connection back to poll() rather than wait on an idle client
+        bool open = serve(c, &wide, conn);
+        pthread_mutex_lock(&lock);
+        if (open) {
+            returned[nreturned++] = conn;
+        } else {
+            close(conn);
+            clients--;
+        }
+        pthread_mutex_unlock(&lock);
+        if (open) {
+            write(wake[1], "", 1);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    char *path = DAEMON_SOCKET;
+    uint32_t workers = 4;
+
+    int opt;
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'h': print_help(argv[0]); return EXIT_SUCCESS;
+        case 's': path = optarg; break;
+        case 'w': workers = strtoul(optarg, NULL, 10); break;
+        case 't': threads = strtoul(optarg, NULL, 10); break;
+        case 'p': placement.pin = true; break;
+        case 'H': placement.huge = true; break;
+        default: print_help(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (!workers) {
+        workers = 1;
+    }
+
+    kernel_select("auto");
+    signal(SIGPIPE, SIG_IGN); // Clients may hang up mid-response
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (!claim_socket(path)) {
+        return EXIT_FAILURE;
+    }
+    if (sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) || listen(sock, BACKLOG)) {
+        fprintf(stderr, "Error: could not listen on %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (pipe(wake)) {
+        fprintf(stderr, "Error: could not create wake pipe: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    fcntl(wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake[1], F_SETFL, O_NONBLOCK); // A full pipe already wakes poll()
+    uint32_t started = 0;
+    for (uint32_t i = 0; i < workers; i++) {
+        pthread_t t;
+        if (!pthread_create(&t, NULL, worker, (void *) (uintptr_t) i)) {
+            pthread_detach(t);
+            started++;
+        }
+    }
+    if (!started) {
+        fprintf(stderr, "Error: could not start any workers\n");
+        return EXIT_FAILURE;
+    }
+
+    // Idle connections are polled here and queued once a request arrives
+    static int idle[CLIENTS];
+    static struct pollfd polled[CLIENTS + 2];
+    uint32_t nidle = 0;
+    while (true) {
+        polled[0] = (struct pollfd) { .fd = sock, .events = POLLIN };
+        polled[1] = (struct pollfd) { .fd = wake[0], .events = POLLIN };
+        for (uint32_t i = 0; i < nidle; i++) {
+            polled[i + 2] = (struct pollfd) { .fd = idle[i], .events = POLLIN };
+        }
+        if (poll(polled, nidle + 2, -1) < 0) {
+            continue;
+        }
+
+        // Queue the ready ones, a hangup is queued too and closed by a worker
+        uint32_t kept = 0;
+        pthread_mutex_lock(&lock);
+        for (uint32_t i = 0; i < nidle; i++) {
+            if (!polled[i + 2].revents) {
+                idle[kept++] = idle[i];
+            } else if (queued == BACKLOG) { // Saturated, shed the connection
+                close(idle[i]);
+                clients--;
+            } else {
+                queue[tail] = idle[i];
+                tail = (tail + 1) % BACKLOG;
+                queued++;
+                pthread_cond_signal(&ready);
+            }
+        }
+        nidle = kept;
+        if (polled[1].revents) {
+            char drain[64];
+            read(wake[0], drain, sizeof(drain));
+            for (uint32_t i = 0; i < nreturned; i++) {
+                idle[nidle++] = returned[i];
+            }
+            nreturned = 0;
+        }
+        pthread_mutex_unlock(&lock);
+
+        // A worker takes a connection once a request starts to arrive, so
+        // bound how long the rest of it may take
+        if (polled[0].revents) {
+            int conn = accept(sock, NULL, NULL);
+            struct timeval timeout = { .tv_sec = TIMEOUT };
+            if (conn >= 0) {
+                setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            }
+            pthread_mutex_lock(&lock);
+            if (conn >= 0 && clients == CLIENTS) {
+                close(conn);
+            } else if (conn >= 0) {
+                idle[nidle++] = conn;
+                clients++;
+            }
+            pthread_mutex_unlock(&lock);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+void print_help(char *path) {
+    printf("SYNOPSIS\n");
+    printf("  A Huffman compression daemon serving requests over a Unix socket.\n\n");
+    printf("USAGE\n");
+    printf("  %s [-h] [-s socket] [-w workers] [-t threads] [-p] [-H]\n\n", path);
+    printf("OPTIONS\n");
+    printf("  -%-14s Program usage and help.\n", "h");
+    printf("  -%-14s Socket path (default: %s).\n", "s socket", DAEMON_SOCKET);
+    printf("  -%-14s Worker threads serving requests (default: 4).\n", "w workers");
+    printf("  -%-14s Decode threads per request (default: 1).\n", "t threads");
+    printf("  -%-14s Pin workers to CPUs, spread across NUMA nodes.\n", "p");
+    printf("  -%-14s Back codec buffers with huge pages.\n", "H");
+}
@@ -4,10 +4,19 @@
 #include "defines.h"
 #include "node.h"
 #include "pq.h"
-#include "stack.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 
+// zeroes histogram and adds min values
+void prep_hist(uint64_t *hist) {
+    for (int i = 0; i < ALPHABET; i++) {
+        hist[i] = 0;
+    }
+    hist[0] = 1;
+    hist[255] = 1;
+}
+
 Node *build_tree(uint64_t hist[static ALPHABET]) {
     PriorityQueue *pq = pq_create(ALPHABET);
     // enqueue all non-zero nodes
@@ -39,7 +48,7 @@ Node *build_tree(uint64_t hist[static ALPHABET]) {
     pq_delete(&pq);
     return root;
 }
-static Code c;
+static _Thread_local Code c;
 void build_codes(Node *root, Code table[static ALPHABET]) {
     uint8_t pop;
     if (root->left) {
@@ -60,32 +69,74 @@ void build_codes(Node *root, Code table[static ALPHABET]) {
     code_pop_bit(&c, &pop);
 }
 
-Node *rebuild_tree(uint16_t nbytes, uint8_t tree[static nbytes]) {
-    Stack *s = stack_create(nbytes);
+// Post-order traversal into buf starting at idx, returns the next index
+static int dump_node(char *buf, int idx, Node *root) {
+    if (root->left) {
+        idx = dump_node(buf, idx, root->left);
+    }
+    if (root->right) {
+        idx = dump_node(buf, idx, root->right);
+    }
+
+    if (!root->left && !root->right) { // leaf
+        buf[idx] = 'L';
+        buf[idx + 1] = root->symbol;
+        idx += 2;
+    } else { // interior
+        buf[idx] = 'I';
+        idx++;
+    }
+    return idx;
+}
+
+// Fill buffer with symbolic huffman tree from post-order traversal
+void tree_dump(char *buf, Node *root) {
+    dump_node(buf, 0, root);
+}
+
+// Rebuilds a tree dump in nodes without allocating. Returns NULL unless
+// the dump is a well-formed tree of distinct symbols with at least two
+// leaves, which bounds it by MAX_NODES.
+Node *rebuild_tree(uint16_t nbytes, const uint8_t tree[static nbytes], Node nodes[static MAX_NODES]) {
+    Node *stack[ALPHABET];
+    bool seen[ALPHABET] = { false };
+    uint32_t top = 0;
+    uint32_t used = 0;
     for (uint16_t i = 0; i < nbytes; i++) {
-        if (tree[i] == 'L') {
-            // Leaf node, make a node and push with following symbol
+        if (tree[i] == 'L' && i + 1 < nbytes && !seen[tree[i + 1]]) {
+            // Leaf node, take a node for the following symbol
             i++;
-            Node *n = node_create(tree[i], 0);
-            stack_push(s, n);
-        } else if (tree[i] == 'I') {
-            // Build interior node
-            Node *left;
-            Node *right;
-            // When popping, the first child is right
-            stack_pop(s, &right);
-            stack_pop(s, &left);
-            Node *parent;
-            parent = node_join(left, right);
-            stack_push(s, parent);
+            seen[tree[i]] = true;
+            nodes[used] = (Node) { .left = NULL, .right = NULL, .symbol = tree[i], .frequency = 0 };
+            stack[top++] = &nodes[used++];
+        } else if (tree[i] == 'I' && top >= 2) {
+            // Interior node, the first child popped is right
+            nodes[used] = (Node) { .left = stack[top - 2], .right = stack[top - 1], .symbol = '$', .frequency = 0 };
+            stack[--top - 1] = &nodes[used++];
+        } else {
+            return NULL;
         }
     }
-    // If tree dump is constructed properly,
-    // there should be a single root node on the stack
-    Node *root;
-    stack_pop(s, &root);
-    stack_delete(&s);
-    return root;
+    return top == 1 && used > 1 ? stack[0] : NULL;
+}
+
+// Walks the tree from bit *pos, returns false if the stream ends mid-symbol
+bool decode_symbol(Node *root, const uint8_t *data, uint64_t nbits, uint64_t *pos, uint8_t *sym) {
+    Node *curr = root;
+    while (curr->left || curr->right) {
+        if (*pos >= nbits) {
+            return false;
+        }
+        uint8_t bit = (data[*pos / 8] >> (*pos % 8)) & 0x1;
+        (*pos)++;
+        if (bit == 0x0 && curr->left) {
+            curr = curr->left;
+        } else if (bit == 0x1 && curr->right) {
+            curr = curr->right;
+        }
+    }
+    *sym = curr->symbol;
+    return true;
 }
 
 void delete_tree(Node **root) {
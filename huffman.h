@@ -5,13 +5,20 @@
 #include "defines.h"
 #include "node.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 
+void prep_hist(uint64_t *hist);
+
 Node *build_tree(uint64_t hist[static ALPHABET]);
 
 void build_codes(Node *root, Code table[static ALPHABET]);
 
-Node *rebuild_tree(uint16_t nbytes, uint8_t tree[static nbytes]);
+void tree_dump(char *buf, Node *root);
+
+Node *rebuild_tree(uint16_t nbytes, const uint8_t tree[static nbytes], Node nodes[static MAX_NODES]);
+
+bool decode_symbol(Node *root, const uint8_t *data, uint64_t nbits, uint64_t *pos, uint8_t *sym);
 
 void delete_tree(Node **root);
 
@@ -0,0 +1,109 @@
+#include "index.h"
+
+#include "block.h"
+#include "header.h"
+#include "io.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+Index *index_create(void) {
+    Index *ix = (Index *) malloc(sizeof(Index));
+    if (ix) {
+        ix->count = 0;
+        ix->capacity = 64;
+        ix->entries = (IndexEntry *) malloc(ix->capacity * sizeof(IndexEntry));
+        if (!ix->entries) {
+            free(ix);
+            ix = NULL;
+        }
+    }
+    return ix;
+}
+
+void index_delete(Index **ix) {
+    if (*ix) {
+        free((*ix)->entries);
+        free(*ix);
+        *ix = NULL;
+    }
+}
+
+// Doubles the capacity until it holds count entries
+static bool index_reserve(Index *ix, uint32_t count) {
+    while (ix->capacity < count) {
+        IndexEntry *grown = (IndexEntry *) realloc(ix->entries, 2 * (uint64_t) ix->capacity * sizeof(IndexEntry));
+        if (!grown) {
+            return false;
+        }
+        ix->entries = grown;
+        ix->capacity *= 2;
+    }
+    return true;
+}
+
+bool index_add(Index *ix, uint64_t offset, uint64_t raw_offset) {
+    if (!index_reserve(ix, ix->count + 1)) {
+        return false;
+    }
+    ix->entries[ix->count++] = (IndexEntry) { offset, raw_offset };
+    return true;
+}
+
+// Writes the entries and trailer, right after the end block at offset end
+void index_write(Index *ix, int outfile, uint64_t end, uint64_t raw_size) {
+    write_bytes(outfile, (uint8_t *) ix->entries, ix->count * sizeof(IndexEntry));
+    IndexTrailer t = { .end = end, .raw_size = raw_size, .count = ix->count, .magic = MAGIC_INDEX };
+    write_bytes(outfile, (uint8_t *) &t, sizeof(t));
+}
+
+// Rebuilds the index of a file written before it had one by walking the
+// block headers, seeking over their payloads
+static bool index_scan(Index *ix, int infile, uint64_t size, IndexTrailer *t) {
+    uint64_t offset = sizeof(Header);
+    uint64_t raw_offset = 0;
+    BlockHeader bh;
+    while (pread(infile, &bh, sizeof(bh), offset) == sizeof(bh)) {
+        if (bh.type == BLOCK_END) {
+            *t = (IndexTrailer) { .end = offset, .raw_size = raw_offset, .count = ix->count, .magic = MAGIC_INDEX };
+            return true;
+        }
+        if (bh.type != BLOCK_SYNC && !index_add(ix, offset, raw_offset)) {
+            return false;
+        }
+        offset += sizeof(bh);
+        if (bh.type != BLOCK_SYNC) {
+            offset += block_extra(&bh) + bh.tree_size + bh.payload_size;
+            raw_offset += bh.raw_size;
+        }
+        if (offset > size) {
+            break;
+        }
+    }
+    return false;
+}
+
+// Loads the index of a seekable block format file from its trailer, or
+// from its block headers if it has none. Does not read any payload.
+bool index_load(Index *ix, int infile, IndexTrailer *t) {
+    struct stat statbuf;
+    if (fstat(infile, &statbuf) || !S_ISREG(statbuf.st_mode)) {
+        return false;
+    }
+    uint64_t size = statbuf.st_size;
+    ix->count = 0;
+    if (size >= sizeof(Header) + sizeof(BlockHeader) + sizeof(IndexTrailer)
+        && pread(infile, t, sizeof(*t), size - sizeof(*t)) == sizeof(*t) && t->magic == MAGIC_INDEX
+        && t->end + sizeof(BlockHeader) + (uint64_t) t->count * sizeof(IndexEntry) + sizeof(*t) == size) {
+        if (!index_reserve(ix, t->count)) {
+            return false;
+        }
+        uint64_t bytes = (uint64_t) t->count * sizeof(IndexEntry);
+        ix->count = t->count;
+        return pread(infile, ix->entries, bytes, t->end + sizeof(BlockHeader)) == (ssize_t) bytes;
+    }
+    return index_scan(ix, infile, size, t);
+}
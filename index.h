@@ -0,0 +1,39 @@
+#ifndef __INDEX_H__
+#define __INDEX_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MAGIC_INDEX 0xDEADB10C // Marks the trailer of a block index.
+
+// Where a block starts in the file and in the uncompressed data
+typedef struct IndexEntry {
+    uint64_t offset; // File offset of the block header.
+    uint64_t raw_offset; // Uncompressed offset of its first byte.
+} IndexEntry;
+
+// Ends the file, after the end block and the index entries
+typedef struct IndexTrailer {
+    uint64_t end; // File offset of the end block.
+    uint64_t raw_size; // Uncompressed bytes in all blocks.
+    uint32_t count; // Index entries.
+    uint32_t magic;
+} IndexTrailer;
+
+typedef struct Index {
+    IndexEntry *entries;
+    uint32_t count;
+    uint32_t capacity;
+} Index;
+
+Index *index_create(void);
+
+void index_delete(Index **ix);
+
+bool index_add(Index *ix, uint64_t offset, uint64_t raw_offset);
+
+void index_write(Index *ix, int outfile, uint64_t end, uint64_t raw_size);
+
+bool index_load(Index *ix, int infile, IndexTrailer *t);
+
+#endif
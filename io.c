@@ -1,14 +1,25 @@
 #include "code.h"
 #include "defines.h"
+#include "kernel.h"
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 
-uint64_t bytes_read = 0;
-uint64_t bytes_written = 0;
-static uint8_t code_buffer[BLOCK];
-static uint32_t code_idx;
+// Thread-local so concurrent requests each get their own buffers
+_Thread_local uint64_t bytes_read = 0;
+_Thread_local uint64_t bytes_written = 0;
+static _Thread_local uint8_t code_buffer[BLOCK + 8]; // slack for word-sized stores
+static _Thread_local uint32_t code_idx;
+
+// Clear counters and encode state before a new file
+void io_reset(void) {
+    bytes_read = 0;
+    bytes_written = 0;
+    memset(code_buffer, 0, sizeof(code_buffer));
+    code_idx = 0;
+}
 
 int read_bytes(int infile, uint8_t *buf, int nbytes) {
     int to_read = nbytes;
@@ -23,6 +34,15 @@ int read_bytes(int infile, uint8_t *buf, int nbytes) {
     return nbytes - to_read;
 }
 
+// Single read, returns whatever is available (at most nbytes)
+int read_some(int infile, uint8_t *buf, int nbytes) {
+    int num_read = read(infile, buf, nbytes);
+    if (num_read > 0) {
+        bytes_read += num_read;
+    }
+    return num_read;
+}
+
 int write_bytes(int outfile, uint8_t *buf, int nbytes) {
     int to_write = nbytes;
     while (to_write) {
@@ -38,9 +58,9 @@ int write_bytes(int outfile, uint8_t *buf, int nbytes) {
 
 // Returns true if there are more bits to read
 bool read_bit(int infile, uint8_t *bit) {
-    static uint8_t buffer[BLOCK];
-    static uint32_t bit_idx;
-    static uint32_t cap; // max bit
+    static _Thread_local uint8_t buffer[BLOCK];
+    static _Thread_local uint32_t bit_idx;
+    static _Thread_local uint32_t cap; // max bit
 
     // initial fill for buffer
     if (!cap) {
@@ -85,6 +105,25 @@ void write_code(int outfile, Code *c) {
     }
 }
 
+// Packs symbols with the selected encode kernel, draining whole bytes
+// whenever the buffer cannot fit another worst-case code
+void write_symbols(int outfile, uint8_t *syms, int n, Code *table) {
+    int i = 0;
+    while (i < n) {
+        uint32_t room = (BLOCK * 8 - code_idx) / (MAX_CODE_SIZE * 8);
+        if (!room) {
+            write_bytes(outfile, code_buffer, code_idx / 8);
+            code_buffer[0] = code_buffer[code_idx / 8];
+            memset(&code_buffer[1], 0, sizeof(code_buffer) - 1);
+            code_idx %= 8;
+            continue;
+        }
+        int count = (uint32_t) (n - i) < room ? n - i : (int) room;
+        code_idx = kernel.encode(&syms[i], count, table, code_buffer, code_idx);
+        i += count;
+    }
+}
+
 // Write the remaining bytes in buffer
 void flush_codes(int outfile) {
     uint32_t bytes = (code_idx / 8) + 1;
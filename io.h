@@ -6,17 +6,23 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-extern uint64_t bytes_read;
-extern uint64_t bytes_written;
+extern _Thread_local uint64_t bytes_read;
+extern _Thread_local uint64_t bytes_written;
+
+void io_reset(void);
 
 int read_bytes(int infile, uint8_t *buf, int nbytes);
 
+int read_some(int infile, uint8_t *buf, int nbytes);
+
 int write_bytes(int outfile, uint8_t *buf, int nbytes);
 
 bool read_bit(int infile, uint8_t *bit);
 
 void write_code(int outfile, Code *c);
 
+void write_symbols(int outfile, uint8_t *syms, int n, Code *table);
+
 void flush_codes(int outfile);
 
 #endif
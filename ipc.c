@@ -0,0 +1,75 @@
+#include "ipc.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Sends msg with up to nfds file descriptors attached (SCM_RIGHTS)
+bool send_msg(int sock, void *msg, uint32_t len, int *fds, int nfds) {
+    struct iovec iov = { .iov_base = msg, .iov_len = len };
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    if (nfds) {
+        memset(control, 0, sizeof(control));
+        mh.msg_control = control;
+        mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cm), fds, nfds * sizeof(int));
+    }
+    return sendmsg(sock, &mh, 0) == (ssize_t) len;
+}
+
+// Receives exactly len bytes, fds not attached are set to -1. Descriptors
+// beyond nfds, or that came with a short message, are closed.
+bool recv_msg(int sock, void *msg, uint32_t len, int *fds, int nfds) {
+    struct iovec iov = { .iov_base = msg, .iov_len = len };
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    mh.msg_control = control;
+    mh.msg_controllen = sizeof(control);
+    for (int i = 0; i < nfds; i++) {
+        fds[i] = -1;
+    }
+    bool whole = recvmsg(sock, &mh, MSG_WAITALL) == (ssize_t) len;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        int got = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int recvd[2];
+        memcpy(recvd, CMSG_DATA(cm), (got < 2 ? got : 2) * sizeof(int));
+        for (int i = 0; i < got && i < 2; i++) {
+            if (whole && i < nfds && fds[i] < 0) {
+                fds[i] = recvd[i];
+            } else {
+                close(recvd[i]); // Unexpected descriptor
+            }
+        }
+    }
+    return whole;
+}
+
+// Index of the power of two microsecond bucket for a latency
+uint32_t latency_bucket(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    uint32_t b = 0;
+    while (us > 1 && b < LATENCY_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
@@ -0,0 +1,48 @@
+#ifndef __IPC_H__
+#define __IPC_H__
+
+#include "place.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DAEMON_SOCKET   "/tmp/huffd.sock" // Default daemon socket path.
+#define LATENCY_BUCKETS 32 // Power of two microsecond buckets.
+
+// Request opcodes, encode and decode carry the input and output fds
+#define OP_ENCODE 'e'
+#define OP_DECODE 'd'
+#define OP_STATS  's'
+
+// Encode settings mirror the encode program's flags, zero for its defaults
+typedef struct Request {
+    uint8_t op;
+    bool blocks; // -b, implied by the others.
+    bool bwt; // -T
+    bool wide; // -w
+    uint8_t stride; // -F, 0 for none or STRIDE_AUTO.
+    uint32_t block_size; // -B, 0 for the largest.
+    uint32_t effort; // -e
+    uint32_t threads; // Decode threads (-t), 0 for the daemon's default.
+} Request;
+
+typedef struct Response {
+    int32_t status; // 0 on success.
+    uint64_t uncompressed;
+    uint64_t compressed;
+    uint64_t latency_ns;
+} Response;
+
+typedef struct Stats {
+    uint64_t encode[LATENCY_BUCKETS];
+    uint64_t decode[LATENCY_BUCKETS];
+    NodeStats nodes[PLACE_NODES]; // Requests served by workers on each node.
+} Stats;
+
+bool send_msg(int sock, void *msg, uint32_t len, int *fds, int nfds);
+
+bool recv_msg(int sock, void *msg, uint32_t len, int *fds, int nfds);
+
+uint32_t latency_bucket(uint64_t ns);
+
+#endif
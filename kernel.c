@@ -0,0 +1,313 @@
+#include "kernel.h"
+
+#include "code.h"
+#include "defines.h"
+#include "table.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Appends the low len bits of word at bit offset bit, out needs 8 bytes of slack
+static inline void put_bits(uint8_t *out, uint32_t bit, uint64_t word) {
+    uint64_t dst;
+    memcpy(&dst, &out[bit / 8], 8);
+    dst |= word << (bit % 8);
+    memcpy(&out[bit / 8], &dst, 8);
+}
+
+// Codes too long for a single word are copied bit by bit
+static inline uint32_t put_code_slow(uint8_t *out, uint32_t bit, Code *c) {
+    for (uint32_t i = 0; i < code_size(c); i++) {
+        out[bit / 8] |= ((c->bits[i / 8] >> (i % 8)) & 0x1) << (bit % 8);
+        bit++;
+    }
+    return bit;
+}
+
+// Bytes are spread over four count tables so runs of one value do not
+// serialize on a single counter. Byte histograms gain nothing from SIMD
+// (gathers and scatters conflict on repeated bytes), so every kernel uses
+// this one.
+static void hist_scalar(const uint8_t *buf, uint64_t n, uint64_t *hist) {
+    uint32_t counts[4][ALPHABET] = { { 0 } };
+    uint64_t i = 0;
+    for (; i + 8 <= n && i < UINT32_MAX - 8; i += 8) {
+        uint64_t word;
+        memcpy(&word, &buf[i], 8);
+        counts[0][word & 0xff]++;
+        counts[1][(word >> 8) & 0xff]++;
+        counts[2][(word >> 16) & 0xff]++;
+        counts[3][(word >> 24) & 0xff]++;
+        counts[0][(word >> 32) & 0xff]++;
+        counts[1][(word >> 40) & 0xff]++;
+        counts[2][(word >> 48) & 0xff]++;
+        counts[3][word >> 56]++;
+    }
+    for (int s = 0; s < ALPHABET; s++) {
+        hist[s] += (uint64_t) counts[0][s] + counts[1][s] + counts[2][s] + counts[3][s];
+    }
+    for (; i < n; i++) {
+        hist[buf[i]]++;
+    }
+}
+
+static uint32_t encode_scalar(const uint8_t *syms, uint32_t n, Code *table, uint8_t *out, uint32_t bit) {
+    for (uint32_t i = 0; i < n; i++) {
+        Code *c = &table[syms[i]];
+        if (c->top > 57) {
+            bit = put_code_slow(out, bit, c);
+            continue;
+        }
+        uint64_t word;
+        memcpy(&word, c->bits, 8);
+        put_bits(out, bit, word & ((1ULL << c->top) - 1));
+        bit += c->top;
+    }
+    return bit;
+}
+
+// Delta codes each byte against the one stride bytes back. With planes,
+// the whole records are also split so byte k of every record is stored
+// together, followed by any partial record as is.
+static void filter_scalar(const uint8_t *in, uint32_t n, uint32_t stride, bool planes, uint8_t *out) {
+    uint32_t records = planes ? n / stride : 0;
+    for (uint32_t r = 0; r < records; r++) {
+        for (uint32_t k = 0; k < stride; k++) {
+            out[k * records + r] = in[r * stride + k] - (r ? in[(r - 1) * stride + k] : 0);
+        }
+    }
+    for (uint32_t i = records * stride; i < n; i++) {
+        out[i] = in[i] - (i >= stride ? in[i - stride] : 0);
+    }
+}
+
+static void unfilter_scalar(const uint8_t *in, uint32_t n, uint32_t stride, bool planes, uint8_t *out) {
+    uint32_t records = planes ? n / stride : 0;
+    for (uint32_t r = 0; r < records; r++) {
+        for (uint32_t k = 0; k < stride; k++) {
+            out[r * stride + k] = in[k * records + r] + (r ? out[(r - 1) * stride + k] : 0);
+        }
+    }
+    for (uint32_t i = records * stride; i < n; i++) {
+        out[i] = in[i] + (i >= stride ? out[i - stride] : 0);
+    }
+}
+
+static uint64_t decode_scalar(DecodeTable *t, const uint8_t *data, uint64_t nbits, uint64_t *pos,
+    uint64_t limit, uint8_t *out, uint64_t nsyms) {
+    return table_decode(t, data, nbits, pos, limit, out, nsyms);
+}
+
+#if defined(__x86_64__)
+__attribute__((target("bmi2"))) static inline uint32_t peek_window_bmi2(
+    const uint8_t *data, uint64_t nbits, uint64_t pos) {
+    uint64_t byte = pos / 8;
+    if (byte + 8 > (nbits + 7) / 8) {
+        return peek_window(data, nbits, pos);
+    }
+    uint64_t word;
+    memcpy(&word, &data[byte], 8);
+    return _bzhi_u64(word >> (pos & 7), TABLE_BITS); // shrx + bzhi
+}
+
+__attribute__((target("bmi2"))) static uint32_t encode_bmi2(
+    const uint8_t *syms, uint32_t n, Code *table, uint8_t *out, uint32_t bit) {
+    for (uint32_t i = 0; i < n; i++) {
+        Code *c = &table[syms[i]];
+        if (c->top > 57) {
+            bit = put_code_slow(out, bit, c);
+            continue;
+        }
+        uint64_t word;
+        uint64_t dst;
+        memcpy(&word, c->bits, 8);
+        memcpy(&dst, &out[bit / 8], 8);
+        dst |= _bzhi_u64(word, c->top) << (bit & 7); // bzhi + shlx
+        memcpy(&out[bit / 8], &dst, 8);
+        bit += c->top;
+    }
+    return bit;
+}
+
+__attribute__((target("bmi2"))) static uint64_t decode_bmi2(DecodeTable *t, const uint8_t *data,
+    uint64_t nbits, uint64_t *pos, uint64_t limit, uint8_t *out, uint64_t nsyms) {
+    return table_decode_with(peek_window_bmi2, t, data, nbits, pos, limit, out, nsyms);
+}
+
+// Byte shuffles for a stride dividing 16: grouping byte k of each record
+// in a vector together, the inverse, and the previous vector's last record
+// repeated
+enum { GROUP, UNGROUP, CARRY };
+
+static inline void filter_masks(uint32_t stride, uint8_t masks[3][16]) {
+    uint32_t per = 16 / stride; // Records per vector
+    for (uint32_t j = 0; j < 16; j++) {
+        masks[GROUP][(j % stride) * per + j / stride] = j;
+        masks[UNGROUP][j] = (j % stride) * per + j / stride;
+        masks[CARRY][j] = 16 - stride + j % stride;
+    }
+}
+
+// Subtracting needs no ordering, so each vector of records loads its own
+// previous records. The deltas are grouped by byte and 16 / stride bytes
+// copied to every plane.
+__attribute__((target("avx2"))) static inline __attribute__((always_inline)) void filter_planes_avx2(
+    const uint8_t *in, uint32_t records, uint32_t stride, uint8_t *out) {
+    uint8_t masks[3][16];
+    filter_masks(stride, masks);
+    __m128i group = _mm_loadu_si128((const __m128i *) masks[GROUP]);
+    uint32_t per = 16 / stride;
+    uint32_t r = 0;
+    for (; r < per && r < records; r++) { // No previous record to load
+        for (uint32_t k = 0; k < stride; k++) {
+            out[k * records + r] = in[r * stride + k] - (r ? in[(r - 1) * stride + k] : 0);
+        }
+    }
+    for (; r + per <= records; r += per) {
+        __m128i v = _mm_loadu_si128((const __m128i *) &in[r * stride]);
+        __m128i p = _mm_loadu_si128((const __m128i *) &in[(r - 1) * stride]);
+        uint8_t lanes[16];
+        _mm_storeu_si128((__m128i *) lanes, _mm_shuffle_epi8(_mm_sub_epi8(v, p), group));
+        for (uint32_t k = 0; k < stride; k++) {
+            memcpy(&out[k * records + r], &lanes[k * per], per);
+        }
+    }
+    for (; r < records; r++) {
+        for (uint32_t k = 0; k < stride; k++) {
+            out[k * records + r] = in[r * stride + k] - in[(r - 1) * stride + k];
+        }
+    }
+}
+
+__attribute__((target("avx2"))) static void filter_avx2(
+    const uint8_t *in, uint32_t n, uint32_t stride, bool planes, uint8_t *out) {
+    uint32_t records = planes && stride > 1 ? n / stride : 0;
+    uint32_t i = records * stride;
+    // Constant strides let the plane copies become single moves
+    switch (records ? stride : 0) {
+    case 0: break;
+    case 2: filter_planes_avx2(in, records, 2, out); break;
+    case 4: filter_planes_avx2(in, records, 4, out); break;
+    case 8: filter_planes_avx2(in, records, 8, out); break;
+    default: filter_planes_avx2(in, records, 16, out); break;
+    }
+    for (; i < n && i < stride; i++) {
+        out[i] = in[i];
+    }
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) &in[i]);
+        __m256i p = _mm256_loadu_si256((const __m256i *) &in[i - stride]);
+        _mm256_storeu_si256((__m256i *) &out[i], _mm256_sub_epi8(v, p));
+    }
+    for (; i < n; i++) {
+        out[i] = in[i] - in[i - stride];
+    }
+}
+
+// Prefix sums along each lane of a vector: shifted adds by stride, 2 *
+// stride and so on, then the previous vector's last record added to every
+// record. Planes are gathered and ungrouped into records first.
+__attribute__((target("avx2"))) static inline __attribute__((always_inline)) uint32_t unfilter_vectors_avx2(
+    const uint8_t *in, uint32_t n, uint32_t records, uint32_t stride, uint8_t *out) {
+    uint8_t masks[3][16];
+    filter_masks(stride, masks);
+    __m128i ungroup = _mm_loadu_si128((const __m128i *) masks[UNGROUP]);
+    __m128i carry = _mm_loadu_si128((const __m128i *) masks[CARRY]);
+    __m128i shifts[4];
+    int nshifts = 0;
+    for (uint32_t sh = stride; sh < 16; sh *= 2) {
+        uint8_t mask[16];
+        for (uint32_t j = 0; j < 16; j++) {
+            mask[j] = j < sh ? 0x80 : j - sh;
+        }
+        shifts[nshifts++] = _mm_loadu_si128((const __m128i *) mask);
+    }
+
+    uint32_t per = 16 / stride;
+    uint32_t end = records ? records * stride : n;
+    __m128i prev = _mm_setzero_si128();
+    uint32_t i = 0;
+    for (; i + 16 <= end; i += 16) {
+        __m128i x;
+        if (records) {
+            uint8_t lanes[16];
+            for (uint32_t k = 0; k < stride; k++) {
+                memcpy(&lanes[k * per], &in[k * records + i / stride], per);
+            }
+            x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) lanes), ungroup);
+        } else {
+            x = _mm_loadu_si128((const __m128i *) &in[i]);
+        }
+        for (int t = 0; t < nshifts; t++) {
+            x = _mm_add_epi8(x, _mm_shuffle_epi8(x, shifts[t]));
+        }
+        x = _mm_add_epi8(x, _mm_shuffle_epi8(prev, carry));
+        _mm_storeu_si128((__m128i *) &out[i], x);
+        prev = x;
+    }
+    for (uint32_t r = i / stride; r < records; r++, i += stride) {
+        for (uint32_t k = 0; k < stride; k++) {
+            out[r * stride + k] = in[k * records + r] + (r ? out[(r - 1) * stride + k] : 0);
+        }
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static void unfilter_avx2(
+    const uint8_t *in, uint32_t n, uint32_t stride, bool planes, uint8_t *out) {
+    uint32_t records = planes && stride > 1 ? n / stride : 0;
+    uint32_t i;
+    switch (stride) {
+    case 1: i = unfilter_vectors_avx2(in, n, 0, 1, out); break;
+    case 2: i = unfilter_vectors_avx2(in, n, records, 2, out); break;
+    case 4: i = unfilter_vectors_avx2(in, n, records, 4, out); break;
+    case 8: i = unfilter_vectors_avx2(in, n, records, 8, out); break;
+    default: i = unfilter_vectors_avx2(in, n, records, 16, out); break;
+    }
+    for (; i < n; i++) {
+        out[i] = in[i] + (i >= stride ? out[i - stride] : 0);
+    }
+}
+#endif
+
+static Kernel kernels[] = {
+    { "scalar", hist_scalar, encode_scalar, decode_scalar, filter_scalar, unfilter_scalar },
+#if defined(__x86_64__)
+    { "bmi2", hist_scalar, encode_bmi2, decode_bmi2, filter_scalar, unfilter_scalar },
+    { "avx2", hist_scalar, encode_bmi2, decode_bmi2, filter_avx2, unfilter_avx2 },
+#endif
+};
+
+Kernel kernel = { "scalar", hist_scalar, encode_scalar, decode_scalar, filter_scalar, unfilter_scalar };
+
+static bool kernel_supported(const char *name) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (!strcmp(name, "bmi2")) {
+        return __builtin_cpu_supports("bmi2");
+    }
+    if (!strcmp(name, "avx2")) {
+        return __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("avx2");
+    }
+#endif
+    return !strcmp(name, "scalar");
+}
+
+// Selects a kernel by name, "auto" picks the best the CPU supports.
+// Returns false if the named kernel is unknown or unsupported.
+bool kernel_select(const char *name) {
+    int count = sizeof(kernels) / sizeof(kernels[0]);
+    for (int i = count - 1; i >= 0; i--) {
+        bool wanted = !strcmp(name, "auto") || !strcmp(name, kernels[i].name);
+        if (wanted && kernel_supported(kernels[i].name)) {
+            kernel = kernels[i];
+            return true;
+        }
+    }
+    return false;
+}
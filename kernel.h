@@ -0,0 +1,24 @@
+#ifndef __KERNEL_H__
+#define __KERNEL_H__
+
+#include "code.h"
+#include "table.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct Kernel {
+    const char *name;
+    void (*hist)(const uint8_t *buf, uint64_t n, uint64_t *hist);
+    uint32_t (*encode)(const uint8_t *syms, uint32_t n, Code *table, uint8_t *out, uint32_t bit);
+    uint64_t (*decode)(DecodeTable *t, const uint8_t *data, uint64_t nbits, uint64_t *pos,
+        uint64_t limit, uint8_t *out, uint64_t nsyms);
+    void (*filter)(const uint8_t *in, uint32_t n, uint32_t stride, bool planes, uint8_t *out);
+    void (*unfilter)(const uint8_t *in, uint32_t n, uint32_t stride, bool planes, uint8_t *out);
+} Kernel;
+
+extern Kernel kernel;
+
+bool kernel_select(const char *name);
+
+#endif
@@ -0,0 +1,238 @@
+#include "parallel.h"
+
+#include "defines.h"
+#include "kernel.h"
+#include "node.h"
+#include "place.h"
+#include "table.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// A slice of the bitstream decoded speculatively by one thread
+typedef struct Segment {
+    DecodeTable *table;
+    const uint8_t *lens; // code length of each symbol, to find where symbols begin
+    const uint8_t *data;
+    uint64_t nbits; // bits in the whole stream
+    uint64_t start; // first bit of the segment
+    uint64_t end; // one past the last bit of the segment
+    uint64_t stop; // bit position after the last decoded symbol
+    uint8_t *syms;
+    uint64_t nsyms;
+    uint64_t cap;
+    uint8_t *marks; // bitmap of positions in [start, end) where a symbol begins, NULL if discarded
+    uint64_t used; // symbols that made it into the output
+    uint32_t index; // thread number, for placement
+    int32_t home; // node of the pinned caller, -1 if it is not pinned
+    uint32_t node; // node the thread ran on
+    uint64_t begin; // when the thread started and finished decoding
+    uint64_t finish;
+} Segment;
+
+// A discarded segment marks nothing, so stitching decodes it serially
+static bool marked(Segment *s, uint64_t pos) {
+    if (!s->marks || pos < s->start || pos >= s->end) {
+        return false;
+    }
+    uint64_t off = pos - s->start;
+    return (s->marks[off / 8] >> (off % 8)) & 0x1;
+}
+
+// Number of symbols the segment decoded before bit pos
+static uint64_t rank(Segment *s, uint64_t pos) {
+    uint64_t off = pos - s->start;
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < off / 8; i++) {
+        count += __builtin_popcount(s->marks[i]);
+    }
+    uint8_t tail = s->marks[off / 8] & ((0x1 << (off % 8)) - 1);
+    return count + __builtin_popcount(tail);
+}
+
+// Drops a segment's output when its buffers cannot be allocated
+static void discard(Segment *s) {
+    free(s->syms);
+    free(s->marks);
+    s->syms = NULL;
+    s->marks = NULL;
+    s->nsyms = 0;
+}
+
+// Depth of each leaf, the table kernel only reports the bits of whole lookups
+static void code_lengths(Node *n, uint8_t depth, uint8_t *lens) {
+    if (!n->left && !n->right) {
+        lens[n->symbol] = depth;
+        return;
+    }
+    code_lengths(n->left, depth + 1, lens);
+    code_lengths(n->right, depth + 1, lens);
+}
+
+static uint64_t segment_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Decode from the start of the segment as if it were a symbol boundary.
+// Threads of a pinned caller, such as a huffd worker, stay on its node;
+// otherwise they are spread like any pool. Buffers are allocated after
+// pinning so their pages are node-local.
+static void *decode_segment(void *arg) {
+    Segment *s = (Segment *) arg;
+    s->begin = segment_ns();
+    s->node = s->home >= 0 ? place_within(s->home) : place_thread(s->index);
+    s->syms = (uint8_t *) malloc(s->cap);
+    s->marks = (uint8_t *) calloc((s->end - s->start) / 8 + 1, 1);
+    if (!s->syms || !s->marks) {
+        discard(s);
+        return NULL;
+    }
+    // Decode with the table kernel a BLOCK of symbols at a time, then mark
+    // where each began while they are still in cache
+    uint64_t pos = s->start;
+    uint64_t at = s->start;
+    while (pos < s->end) {
+        if (s->nsyms == s->cap) {
+            uint8_t *syms = (uint8_t *) realloc(s->syms, 2 * s->cap);
+            if (!syms) {
+                discard(s);
+                return NULL;
+            }
+            s->syms = syms;
+            s->cap *= 2;
+        }
+        uint64_t want = s->cap - s->nsyms < BLOCK ? s->cap - s->nsyms : BLOCK;
+        uint64_t got = kernel.decode(s->table, s->data, s->nbits, &pos, s->end, &s->syms[s->nsyms], want);
+        for (uint64_t i = 0; i < got && at < s->end; i++) { // A lookup may run past end
+            uint64_t off = at - s->start;
+            s->marks[off / 8] |= 0x1 << (off % 8);
+            at += s->lens[s->syms[s->nsyms + i]];
+        }
+        s->nsyms += got;
+        if (!got) {
+            break; // Stream ended mid-symbol
+        }
+    }
+    s->stop = pos;
+    s->finish = segment_ns();
+    return NULL;
+}
+
+// Decodes up to nsyms symbols from a single-tree bitstream using nthreads.
+// Each thread starts at an arbitrary bit offset; because Huffman codes
+// resynchronize quickly, the true decode soon lands on a boundary the thread
+// also found, after which the thread's output is exact. The prefix before
+// that point is redone serially while stitching. Each thread's symbols that
+// made it into the output are added to nodes, if given, under the node it
+// ran on, with the wall time from the node's first thread starting to its
+// last one finishing.
+uint64_t parallel_decode(DecodeTable *t, const uint8_t *data, uint64_t nbits, uint8_t *out,
+    uint64_t nsyms, uint32_t nthreads, NodeStats *nodes) {
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    if (nbits / nthreads < BLOCK * 8) { // too small to be worth splitting
+        nthreads = nbits / (BLOCK * 8) + 1;
+    }
+
+    uint8_t lens[ALPHABET] = { 0 };
+    code_lengths(t->root, 0, lens);
+
+    Segment *segs = (Segment *) calloc(nthreads, sizeof(Segment));
+    pthread_t *threads = (pthread_t *) calloc(nthreads, sizeof(pthread_t));
+    bool *started = (bool *) calloc(nthreads, sizeof(bool));
+    if (!segs || !threads || !started) {
+        nthreads = 0; // Decoded serially below
+    }
+    uint64_t span = nthreads ? nbits / nthreads : 0;
+    for (uint32_t i = 0; i < nthreads; i++) {
+        Segment *s = &segs[i];
+        s->table = t;
+        s->lens = lens;
+        s->data = data;
+        s->nbits = nbits;
+        s->start = i * span;
+        s->end = (i == nthreads - 1) ? nbits : (i + 1) * span;
+        s->cap = (s->end - s->start) / 4 + 1;
+        s->index = i;
+        s->home = place_home;
+        started[i] = !pthread_create(&threads[i], NULL, decode_segment, s);
+    }
+    for (uint32_t i = 0; i < nthreads; i++) {
+        if (!started[i]) {
+            continue; // No marks, stitched serially
+        }
+        pthread_join(threads[i], NULL);
+    }
+    // Stitch segments together, pos tracks the true decode position
+    uint64_t n = 0;
+    uint64_t pos = 0;
+    for (uint32_t i = 0; i < nthreads && n < nsyms; i++) {
+        Segment *s = &segs[i];
+        // Decode serially until we land on a boundary this segment also
+        // found, a few symbols at a time and then checking where each began
+        while (pos < s->end && !marked(s, pos) && n < nsyms) {
+            uint64_t want = s->marks && nsyms - n > 64 ? 64 : nsyms - n;
+            uint64_t at = pos;
+            uint64_t got = kernel.decode(t, data, nbits, &pos, s->end, &out[n], want);
+            if (!got) {
+                break;
+            }
+            uint64_t k = 0;
+            do {
+                at += lens[out[n + k]];
+                k++;
+            } while (k < got && !marked(s, at));
+            n += k;
+            pos = at;
+        }
+        if (marked(s, pos)) { // synchronized
+            uint64_t first = rank(s, pos);
+            uint64_t count = s->nsyms - first;
+            if (count > nsyms - n) {
+                count = nsyms - n;
+            }
+            memcpy(&out[n], &s->syms[first], count);
+            n += count;
+            s->used = count;
+            pos = s->stop;
+        }
+    }
+    // Whatever no segment covered, e.g. if none could be started
+    while (n < nsyms) {
+        uint64_t got = kernel.decode(t, data, nbits, &pos, nbits, &out[n], nsyms - n);
+        if (!got) {
+            break;
+        }
+        n += got;
+    }
+    for (uint32_t node = 0; nodes && node < PLACE_NODES; node++) {
+        uint64_t first = UINT64_MAX;
+        uint64_t last = 0;
+        for (uint32_t i = 0; i < nthreads; i++) {
+            Segment *s = &segs[i];
+            if (started[i] && s->node == node) {
+                nodes[node].tasks++;
+                nodes[node].bytes += s->used;
+                first = s->begin < first ? s->begin : first;
+                last = s->finish > last ? s->finish : last;
+            }
+        }
+        nodes[node].ns += last > first ? last - first : 0;
+    }
+
+    for (uint32_t i = 0; i < nthreads; i++) {
+        free(segs[i].syms);
+        free(segs[i].marks);
+    }
+    free(segs);
+    free(threads);
+    free(started);
+    return n;
+}
@@ -0,0 +1,13 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include "node.h"
+#include "place.h"
+#include "table.h"
+
+#include <stdint.h>
+
+uint64_t parallel_decode(DecodeTable *t, const uint8_t *data, uint64_t nbits, uint8_t *out,
+    uint64_t nsyms, uint32_t nthreads, NodeStats *nodes);
+
+#endif
@@ -0,0 +1,173 @@
+#include "place.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define HUGE_PAGE      (2 * 1024 * 1024) // x86-64 huge page size.
+#define MPOL_PREFERRED 1 // From <numaif.h>, prefer a node without failing.
+
+// The raw getcpu, sched_setaffinity and mbind syscalls stand in for
+// <sched.h> GNU extensions and libnuma, which would need _GNU_SOURCE ahead
+// of every module and another library.
+
+Placement placement = { .pin = false, .huge = false };
+
+static uint8_t node_of[PLACE_CPUS]; // Node of each CPU.
+static bool online[PLACE_CPUS];
+static uint32_t nodes = 1;
+static bool shared_last; // Nodes past PLACE_NODES were folded into the last.
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+_Thread_local int32_t place_home = -1; // Node the thread was pinned to.
+
+// Reads each node's CPU list from sysfs, e.g. "0-3,8-11". Without sysfs
+// every online CPU is on node 0. CPUs of nodes past PLACE_NODES count as
+// the last node.
+static void place_init(void) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (long cpu = 0; cpu < ncpus && cpu < PLACE_CPUS; cpu++) {
+        online[cpu] = true;
+    }
+    DIR *dir = opendir("/sys/devices/system/node");
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir))) {
+        unsigned id;
+        char end;
+        if (sscanf(entry->d_name, "node%u%c", &id, &end) != 1) {
+            continue;
+        }
+        uint32_t node = id < PLACE_NODES ? id : PLACE_NODES - 1;
+        shared_last = shared_last || id >= PLACE_NODES;
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", id);
+        FILE *f = fopen(path, "r");
+        if (!f) {
+            continue;
+        }
+        unsigned lo;
+        unsigned hi;
+        int got;
+        while ((got = fscanf(f, "%u-%u", &lo, &hi)) >= 1) {
+            hi = got == 2 ? hi : lo;
+            for (unsigned cpu = lo; cpu <= hi && cpu < PLACE_CPUS; cpu++) {
+                node_of[cpu] = node;
+                online[cpu] = true;
+            }
+            if (fgetc(f) != ',') {
+                break;
+            }
+        }
+        fclose(f);
+        nodes = node + 1 > nodes ? node + 1 : nodes;
+    }
+    if (dir) {
+        closedir(dir);
+    }
+}
+
+uint32_t place_nodes(void) {
+    pthread_once(&once, place_init);
+    return nodes;
+}
+
+// Node of the CPU the calling thread runs on
+uint32_t place_node(void) {
+    pthread_once(&once, place_init);
+    unsigned cpu = 0;
+    if (syscall(SYS_getcpu, &cpu, NULL, NULL) != 0 || cpu >= PLACE_CPUS) {
+        return 0;
+    }
+    return node_of[cpu];
+}
+
+// Pins the calling thread, the index-th of a pool, if placement.pin is set.
+// Consecutive indices go to different nodes, then to different CPUs within
+// a node. Returns the node the thread runs on.
+uint32_t place_thread(uint32_t index) {
+    pthread_once(&once, place_init);
+    if (!placement.pin) {
+        return place_node();
+    }
+    uint32_t node = index % nodes;
+    uint32_t count = 0;
+    for (uint32_t cpu = 0; cpu < PLACE_CPUS; cpu++) {
+        count += online[cpu] && node_of[cpu] == node;
+    }
+    if (!count) {
+        return place_node();
+    }
+    uint32_t pick = (index / nodes) % count;
+    for (uint32_t cpu = 0; cpu < PLACE_CPUS; cpu++) {
+        if (online[cpu] && node_of[cpu] == node && !pick--) {
+            unsigned long set[PLACE_CPUS / 64] = { 0 };
+            set[cpu / 64] = 1UL << cpu % 64;
+            syscall(SYS_sched_setaffinity, 0, sizeof(set), set);
+            break;
+        }
+    }
+    place_home = node;
+    return node;
+}
+
+// Confines the calling thread to the CPUs of node, leaving the scheduler
+// to balance it with the node's other threads. Helpers of a pinned pool
+// thread use this to stay on its node without piling onto its CPU.
+uint32_t place_within(uint32_t node) {
+    pthread_once(&once, place_init);
+    unsigned long set[PLACE_CPUS / 64] = { 0 };
+    for (uint32_t cpu = 0; cpu < PLACE_CPUS; cpu++) {
+        if (online[cpu] && node_of[cpu] == node) {
+            set[cpu / 64] |= 1UL << cpu % 64;
+        }
+    }
+    syscall(SYS_sched_setaffinity, 0, sizeof(set), set);
+    place_home = node;
+    return node;
+}
+
+// Maps a large buffer, preferring the calling thread's node when placement
+// is enabled. With placement.huge it tries explicit huge pages, then asks
+// for transparent ones. Pages are not touched here, so first use also
+// lands locally.
+void *place_alloc(size_t size) {
+    pthread_once(&once, place_init);
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void *p = MAP_FAILED;
+    if (placement.huge) {
+        size = (size + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+    }
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (p == MAP_FAILED) {
+            return NULL;
+        }
+        if (placement.huge) {
+            madvise(p, size, MADV_HUGEPAGE);
+        }
+    }
+    // Without -p or -H the default policy is kept. A folded node's memory
+    // is left to first touch rather than guessed.
+    uint32_t node = place_node();
+    bool placed = placement.pin || placement.huge;
+    if (placed && nodes > 1 && !(shared_last && node == PLACE_NODES - 1)) {
+        unsigned long mask = 1UL << node;
+        syscall(SYS_mbind, p, size, MPOL_PREFERRED, &mask, PLACE_NODES + 1, 0);
+    }
+    return p;
+}
+
+void place_free(void *p, size_t size) {
+    if (p) {
+        if (placement.huge) {
+            size = (size + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+        }
+        munmap(p, size);
+    }
+}
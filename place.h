@@ -0,0 +1,40 @@
+#ifndef __PLACE_H__
+#define __PLACE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PLACE_NODES 16 // NUMA nodes tracked, higher ones count as the last.
+#define PLACE_CPUS  1024 // CPUs tracked.
+
+// Thread and memory placement, set from the command line
+typedef struct Placement {
+    bool pin; // Pin threads to CPUs, spread across nodes.
+    bool huge; // Back large buffers with huge pages.
+} Placement;
+
+// Work done by threads on one node
+typedef struct NodeStats {
+    uint64_t tasks;
+    uint64_t bytes;
+    uint64_t ns; // Wall time for decode threads, summed request time in huffd.
+} NodeStats;
+
+extern Placement placement;
+
+extern _Thread_local int32_t place_home;
+
+uint32_t place_nodes(void);
+
+uint32_t place_node(void);
+
+uint32_t place_thread(uint32_t index);
+
+uint32_t place_within(uint32_t node);
+
+void *place_alloc(size_t size);
+
+void place_free(void *p, size_t size);
+
+#endif
@@ -0,0 +1,557 @@
+#include "search.h"
+
+#include "block.h"
+#include "codec.h"
+#include "defines.h"
+#include "header.h"
+#include "index.h"
+#include "io.h"
+#include "kernel.h"
+#include "place.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h> // only use for printf, else use io.c
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SEARCH_STREAM UINT64_MAX // Read offset meaning the current file position.
+
+// A run of blocks searched by one worker. A task finishes the line that
+// crosses raw_end, so the next task skips its data up to the first newline.
+typedef struct Task {
+    uint32_t entry; // Index entry of its first block.
+    uint64_t offset; // File offset of its first block.
+    uint64_t end; // File offset of the next task's first block.
+    uint64_t raw_offset; // Uncompressed offset of its first byte.
+    uint64_t raw_end; // Uncompressed offset of the next task's first byte.
+    uint8_t *out; // Matches as offset, length and line, replayed in order.
+    uint64_t nout;
+    uint64_t cap;
+    bool ok;
+    bool done;
+} Task;
+
+// Tasks shared by the workers of one search_file() call
+typedef struct Pool {
+    int infile;
+    const uint8_t *pattern;
+    uint32_t plen;
+    Index *index;
+    Task *tasks;
+    uint32_t ntasks;
+    uint32_t next; // Next task to take.
+    uint32_t window; // Tasks taken before the oldest one is replayed.
+    uint32_t replayed;
+    bool failed;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} Pool;
+
+// Worker argument
+typedef struct Worker {
+    Pool *pool;
+    uint32_t index;
+} Worker;
+
+// Finds the pattern in buf[0, n): memchr() for its rarest byte, then memcmp()
+static const uint8_t *search_find(Search *s, const uint8_t *buf, uint64_t n) {
+    if (n < s->plen) {
+        return NULL;
+    }
+    if (s->anchor < 0) { // Rarest in the first data seen
+        uint64_t hist[ALPHABET] = { 0 };
+        kernel.hist(buf, n < SEARCH_CHUNK ? n : SEARCH_CHUNK, hist);
+        s->anchor = 0;
+        for (uint32_t i = 1; i < s->plen; i++) {
+            if (hist[s->pattern[i]] < hist[s->pattern[s->anchor]]) {
+                s->anchor = i;
+            }
+        }
+    }
+    uint8_t key = s->pattern[s->anchor];
+    const uint8_t *p = buf + s->anchor;
+    const uint8_t *last = buf + n - s->plen + s->anchor; // Last place the anchor can be
+    while (p <= last && (p = (const uint8_t *) memchr(p, key, last - p + 1))) {
+        if (!memcmp(p - s->anchor, s->pattern, s->plen)) {
+            return p - s->anchor;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+// Adds bytes to the current line, keeping its head to report and its tail
+static void line_append(Search *s, const uint8_t *buf, uint64_t n) {
+    uint32_t room = SEARCH_LINE - s->nline;
+    uint32_t head = n < room ? n : room;
+    memcpy(&s->line[s->nline], buf, head);
+    s->nline += head;
+
+    uint32_t keep = s->plen - 1;
+    if (n >= keep) {
+        memcpy(s->tail, buf + n - keep, keep);
+        s->ntail = keep;
+    } else {
+        uint32_t old = s->ntail + n > keep ? keep - n : s->ntail;
+        memmove(s->tail, &s->tail[s->ntail - old], old);
+        memcpy(&s->tail[old], buf, n);
+        s->ntail = old + n;
+    }
+}
+
+// Reports the current line if it matched and starts the next one at offset
+static void line_end(Search *s, uint64_t offset) {
+    if (s->matched) {
+        s->report(s->arg, s->line_start, s->line, s->nline);
+    }
+    s->line_start = offset;
+    s->matched = false;
+    s->nline = 0;
+    s->ntail = 0;
+}
+
+void search_begin(Search *s, const uint8_t *pattern, uint32_t plen, uint64_t offset, SearchReport report, void *arg) {
+    s->pattern = pattern;
+    s->plen = plen;
+    s->anchor = -1;
+    s->offset = offset;
+    s->line_start = offset;
+    s->matched = false;
+    s->nline = 0;
+    s->ntail = 0;
+    s->report = report;
+    s->arg = arg;
+}
+
+// Scans the next n bytes of data. Only lines with a hit are looked at
+// byte by byte; the rest is skipped by search_find().
+void search_chunk(Search *s, const uint8_t *buf, uint64_t n) {
+    uint64_t i = 0;
+
+    // Finish the line carried from the previous chunk, checking for a match
+    // that starts in its tail
+    if (s->line_start < s->offset) {
+        const uint8_t *nl = (const uint8_t *) memchr(buf, '\n', n);
+        uint64_t len = nl ? (uint64_t) (nl - buf) : n;
+        if (!s->matched) {
+            uint8_t span[2 * SEARCH_PATTERN];
+            uint32_t more = len < s->plen - 1 ? len : s->plen - 1;
+            memcpy(span, s->tail, s->ntail);
+            memcpy(&span[s->ntail], buf, more);
+            s->matched = search_find(s, span, s->ntail + more) || search_find(s, buf, len);
+        }
+        line_append(s, buf, len);
+        if (!nl) {
+            s->offset += n;
+            return;
+        }
+        i = len + 1;
+        line_end(s, s->offset + i);
+    }
+
+    // Whole lines, report the line around each hit
+    const uint8_t *hit;
+    while (i < n && (hit = search_find(s, &buf[i], n - i))) {
+        const uint8_t *begin = hit;
+        while (begin > &buf[i] && begin[-1] != '\n') {
+            begin--;
+        }
+        const uint8_t *nl = (const uint8_t *) memchr(hit, '\n', &buf[n] - hit);
+        s->line_start = s->offset + (begin - buf);
+        s->matched = true;
+        line_append(s, begin, (nl ? nl : &buf[n]) - begin);
+        if (!nl) {
+            s->offset += n;
+            return;
+        }
+        i = nl - buf + 1;
+        line_end(s, s->offset + i);
+    }
+
+    // Carry an unterminated last line into the next chunk
+    const uint8_t *begin = &buf[n];
+    while (begin > &buf[i] && begin[-1] != '\n') {
+        begin--;
+    }
+    s->line_start = s->offset + (begin - buf);
+    line_append(s, begin, &buf[n] - begin);
+    s->offset += n;
+}
+
+// Reports a last line without a newline
+void search_end(Search *s) {
+    if (s->line_start < s->offset) {
+        line_end(s, s->offset);
+    }
+}
+
+// Reads n bytes at *pos and advances it, or from the current position
+static bool read_at(int infile, uint8_t *buf, uint32_t n, uint64_t *pos) {
+    if (*pos == SEARCH_STREAM) {
+        return read_bytes(infile, buf, n) == (int) n;
+    }
+    if (pread(infile, buf, n, *pos) != (ssize_t) n) {
+        return false;
+    }
+    *pos += n;
+    return true;
+}
+
+// Where a task is in its data
+typedef struct Feed {
+    bool skipping; // Dropping data up to the first newline.
+    bool finished; // Past raw_end and its line is done.
+    uint64_t raw; // Uncompressed offset of the next byte.
+    uint64_t raw_end;
+} Feed;
+
+// Passes decoded data to the matcher, cutting it at the task's boundaries
+static void feed(Search *s, Feed *f, const uint8_t *buf, uint64_t n) {
+    uint64_t raw = f->raw;
+    f->raw += n;
+    if (f->skipping) {
+        const uint8_t *nl = (const uint8_t *) memchr(buf, '\n', n);
+        if (!nl) {
+            f->finished = f->raw >= f->raw_end;
+            return;
+        }
+        if (raw + (nl - buf) >= f->raw_end) {
+            f->finished = true; // The previous task's last line covers all of ours
+            return;
+        }
+        f->skipping = false;
+        uint64_t skip = nl - buf + 1;
+        s->offset = s->line_start = raw + skip;
+        buf += skip;
+        n -= skip;
+        raw += skip;
+    }
+    if (raw + n > f->raw_end) {
+        uint64_t cut = f->raw_end > raw ? f->raw_end - raw : 0;
+        const uint8_t *nl = (const uint8_t *) memchr(&buf[cut], '\n', n - cut);
+        if (nl) {
+            n = nl - buf + 1;
+            f->finished = true;
+        }
+    }
+    search_chunk(s, buf, n);
+}
+
+// Decodes one block and feeds it. Plain Huffman blocks are decoded a chunk
+// at a time so the matcher reads them from cache; the other types need the
+// whole block first.
+static bool search_block(Codec *c, Search *s, Feed *f, BlockHeader *bh) {
+    BlockDecoder *d = c->decoder;
+    if ((bh->type == BLOCK_HUFFMAN || bh->type == BLOCK_REPEAT) && !bh->flags) {
+        DecodeTable *t = &d->table;
+        if (bh->type == BLOCK_HUFFMAN && !table_load(t, bh->tree_size, c->payload)) {
+            return false;
+        } else if (!t->root) {
+            return false;
+        }
+        uint64_t nbits = (uint64_t) bh->payload_size * 8;
+        uint64_t pos = 0;
+        for (uint32_t done = 0; done < bh->raw_size && !f->finished;) {
+            uint32_t want = bh->raw_size - done < SEARCH_CHUNK ? bh->raw_size - done : SEARCH_CHUNK;
+            if (kernel.decode(t, &c->payload[bh->tree_size], nbits, &pos, nbits, c->raw, want) != want) {
+                return false;
+            }
+            feed(s, f, c->raw, want);
+            done += want;
+        }
+        return true;
+    }
+    if (!decode_block(bh, c->payload, d, c->raw)) {
+        return false;
+    }
+    for (uint32_t done = 0; done < bh->raw_size && !f->finished; done += SEARCH_CHUNK) {
+        feed(s, f, &c->raw[done], bh->raw_size - done < SEARCH_CHUNK ? bh->raw_size - done : SEARCH_CHUNK);
+    }
+    return true;
+}
+
+// A repeat block before any Huffman block of its task needs the tree of the
+// last Huffman block before the task, which is read without decoding it
+static bool load_tree(Codec *c, int infile, Index *ix, uint32_t entry) {
+    for (uint32_t i = entry; i-- > 0;) {
+        BlockHeader bh;
+        uint64_t pos = ix->entries[i].offset;
+        if (!read_at(infile, (uint8_t *) &bh, sizeof(bh), &pos) || !block_valid(&bh)) {
+            return false;
+        }
+        if (bh.type == BLOCK_HUFFMAN) {
+            uint32_t size = block_extra(&bh) + bh.tree_size;
+            return read_at(infile, c->payload, size, &pos)
+                   && table_load(&c->decoder->table, bh.tree_size, &c->payload[block_extra(&bh)]);
+        }
+    }
+    return false;
+}
+
+// Searches the blocks of a task, reading from its file offset or, for
+// SEARCH_STREAM, sequentially from the current position
+static bool search_task(Codec *c, int infile, Index *ix, Task *t, Search *s) {
+    Feed f = { .skipping = t->raw_offset > 0, .finished = false, .raw = t->raw_offset, .raw_end = t->raw_end };
+    uint64_t pos = t->offset;
+    BlockHeader bh;
+    c->decoder->table.root = NULL;
+    while (!f.finished && read_at(infile, (uint8_t *) &bh, sizeof(bh), &pos)) {
+        if (bh.type == BLOCK_END) {
+            break;
+        }
+        if (bh.type == BLOCK_SYNC) {
+            continue;
+        }
+        if (!block_valid(&bh)) {
+            return false;
+        }
+        if (bh.type == BLOCK_REPEAT && !c->decoder->table.root && !load_tree(c, infile, ix, t->entry)) {
+            return false;
+        }
+        uint32_t size = block_extra(&bh) + bh.tree_size + bh.payload_size;
+        if (!read_at(infile, c->payload, size, &pos) || !search_block(c, s, &f, &bh)) {
+            return false;
+        }
+    }
+    if (!f.skipping) {
+        search_end(s);
+    }
+    c->uncompressed = f.raw - t->raw_offset;
+    return true;
+}
+
+// Collects a task's matches for the main thread to replay in order
+static void task_report(void *arg, uint64_t offset, const uint8_t *line, uint32_t len) {
+    Task *t = (Task *) arg;
+    uint64_t need = t->nout + sizeof(offset) + sizeof(len) + len;
+    if (need > t->cap) {
+        uint64_t cap = need > 2 * t->cap ? need : 2 * t->cap;
+        uint8_t *out = (uint8_t *) realloc(t->out, cap);
+        if (!out) {
+            t->ok = false;
+            return;
+        }
+        t->out = out;
+        t->cap = cap;
+    }
+    memcpy(&t->out[t->nout], &offset, sizeof(offset));
+    memcpy(&t->out[t->nout + sizeof(offset)], &len, sizeof(len));
+    memcpy(&t->out[t->nout + sizeof(offset) + sizeof(len)], line, len);
+    t->nout = need;
+}
+
+// Takes tasks in order, at most window ahead of the main thread's replay so
+// buffered matches stay bounded
+static void *search_worker(void *arg) {
+    Worker *w = (Worker *) arg;
+    Pool *p = w->pool;
+    place_thread(w->index);
+    Codec *c = codec_create(1);
+    Search *s = (Search *) malloc(sizeof(Search));
+    while (true) {
+        pthread_mutex_lock(&p->lock);
+        while (!p->failed && p->next < p->ntasks && p->next >= p->replayed + p->window) {
+            pthread_cond_wait(&p->cond, &p->lock);
+        }
+        if (p->failed || p->next == p->ntasks) {
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+        Task *t = &p->tasks[p->next++];
+        pthread_mutex_unlock(&p->lock);
+
+        t->ok = c && s;
+        if (t->ok) {
+            search_begin(s, p->pattern, p->plen, t->raw_offset, task_report, t);
+            t->ok = search_task(c, p->infile, p->index, t, s) && t->ok;
+        }
+        pthread_mutex_lock(&p->lock);
+        t->done = true;
+        pthread_cond_broadcast(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+    }
+    free(s);
+    codec_delete(&c);
+    return NULL;
+}
+
+// Splits the indexed blocks into tasks of about SEARCH_TASK bytes and
+// searches them on up to c->threads workers. *ran is false, with nothing
+// reported, if no worker could be started.
+static bool search_parallel(Codec *c, int infile, Index *ix, IndexTrailer *tr, const uint8_t *pattern,
+    uint32_t plen, SearchReport report, void *arg, bool *ran) {
+    Pool p = { .infile = infile, .pattern = pattern, .plen = plen, .index = ix, .window = 2 * c->threads };
+    p.tasks = (Task *) calloc(ix->count, sizeof(Task));
+    pthread_t *threads = (pthread_t *) calloc(c->threads, sizeof(pthread_t));
+    Worker *workers = (Worker *) calloc(c->threads, sizeof(Worker));
+    *ran = p.tasks && threads && workers;
+    if (!*ran) {
+        free(p.tasks);
+        free(threads);
+        free(workers);
+        return false;
+    }
+    for (uint32_t i = 0; i < ix->count; i++) {
+        IndexEntry *e = &ix->entries[i];
+        if (!p.ntasks || e->raw_offset - p.tasks[p.ntasks - 1].raw_offset >= SEARCH_TASK) {
+            if (p.ntasks) {
+                p.tasks[p.ntasks - 1].end = e->offset;
+                p.tasks[p.ntasks - 1].raw_end = e->raw_offset;
+            }
+            p.tasks[p.ntasks] = (Task) { .entry = i, .offset = e->offset, .raw_offset = e->raw_offset };
+            p.ntasks++;
+        }
+    }
+    p.tasks[p.ntasks - 1].end = tr->end;
+    p.tasks[p.ntasks - 1].raw_end = UINT64_MAX;
+
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.cond, NULL);
+    uint32_t started = 0;
+    for (uint32_t i = 0; i < c->threads; i++) {
+        workers[i] = (Worker) { .pool = &p, .index = i };
+        if (pthread_create(&threads[i], NULL, search_worker, &workers[i])) {
+            break;
+        }
+        started++;
+    }
+    // Fewer workers keep fewer tasks in flight
+    pthread_mutex_lock(&p.lock);
+    p.window = 2 * started;
+    pthread_mutex_unlock(&p.lock);
+    *ran = started > 0;
+
+    // Replay each task's matches once it and all before it are done
+    bool ok = true;
+    for (uint32_t i = 0; i < p.ntasks && ok && started; i++) {
+        Task *t = &p.tasks[i];
+        pthread_mutex_lock(&p.lock);
+        while (!t->done) {
+            pthread_cond_wait(&p.cond, &p.lock);
+        }
+        pthread_mutex_unlock(&p.lock);
+        ok = t->ok;
+        for (uint64_t at = 0; ok && at < t->nout;) {
+            uint64_t offset;
+            uint32_t len;
+            memcpy(&offset, &t->out[at], sizeof(offset));
+            memcpy(&len, &t->out[at + sizeof(offset)], sizeof(len));
+            at += sizeof(offset) + sizeof(len);
+            report(arg, offset, &t->out[at], len);
+            at += len;
+        }
+        free(t->out);
+        t->out = NULL;
+        pthread_mutex_lock(&p.lock);
+        p.replayed++;
+        p.failed = !ok;
+        pthread_cond_broadcast(&p.cond);
+        pthread_mutex_unlock(&p.lock);
+    }
+    for (uint32_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (uint32_t i = 0; i < p.ntasks; i++) {
+        free(p.tasks[i].out);
+    }
+    pthread_mutex_destroy(&p.lock);
+    pthread_cond_destroy(&p.cond);
+    free(p.tasks);
+    free(threads);
+    free(workers);
+    c->compressed = tr->end;
+    c->uncompressed = tr->raw_size;
+    return ok;
+}
+
+// Decodes a single-tree file a chunk at a time and scans it, false if the
+// input ends before file_size bytes
+static bool search_legacy(Codec *c, int infile, Header *h, Search *s) {
+    uint8_t *in = c->payload; // 2 * SEARCH_CHUNK of input
+    uint64_t nbytes = 0;
+    uint64_t pos = 0; // bit position in in
+    uint64_t decoded = 0;
+    bool eof = false;
+    while (decoded < h->file_size) {
+        // Move the unconsumed tail to the front and refill
+        uint64_t keep = pos / 8;
+        memmove(in, &in[keep], nbytes - keep);
+        nbytes -= keep;
+        pos -= keep * 8;
+        if (!eof) {
+            int to_read = 2 * SEARCH_CHUNK - nbytes;
+            int num_read = read_bytes(infile, &in[nbytes], to_read);
+            eof = num_read < to_read;
+            nbytes += num_read;
+        }
+
+        uint64_t nbits = nbytes * 8;
+        uint64_t limit = eof ? nbits : nbits - MAX_CODE_SIZE * 8;
+        uint64_t want = h->file_size - decoded < SEARCH_CHUNK ? h->file_size - decoded : SEARCH_CHUNK;
+        uint64_t n = kernel.decode(&c->decoder->table, in, nbits, &pos, limit, c->raw, want);
+        search_chunk(s, c->raw, n);
+        decoded += n;
+        if (eof && !n) {
+            break; // Truncated input
+        }
+    }
+    c->uncompressed = decoded;
+    return decoded == h->file_size;
+}
+
+// Reports every line of the compressed file containing pattern, without
+// writing the decoded data anywhere. Block files with an index are
+// searched on c->threads workers when the input is a regular file.
+bool search_file(Codec *c, int infile, const uint8_t *pattern, uint32_t plen, SearchReport report, void *arg) {
+    if (!plen || plen > SEARCH_PATTERN || memchr(pattern, '\n', plen)) {
+        fprintf(stderr, "Error: pattern must be 1 to %d bytes without a newline\n", SEARCH_PATTERN);
+        return false;
+    }
+    io_reset();
+    Header h;
+    if (read_bytes(infile, (uint8_t *) &h, sizeof(Header)) != sizeof(Header)) {
+        fprintf(stderr, "Error: invalid file header\n");
+        return false;
+    }
+
+    Search *s = (Search *) malloc(sizeof(Search));
+    if (!s) {
+        return false;
+    }
+    search_begin(s, pattern, plen, 0, report, arg);
+    bool ok = true;
+    if (h.magic == MAGIC_BLOCKS && h.tree_size == 0) {
+        IndexTrailer tr;
+        bool ran = false;
+        if (c->threads > 1 && index_load(c->index, infile, &tr) && c->index->count) {
+            ok = search_parallel(c, infile, c->index, &tr, pattern, plen, report, arg, &ran);
+        }
+        if (!ran) { // Serially from just after the header
+            Task t = { .offset = SEARCH_STREAM, .end = UINT64_MAX, .raw_end = UINT64_MAX };
+            ok = search_task(c, infile, c->index, &t, s);
+            c->compressed = bytes_read;
+        }
+    } else if (h.magic == MAGIC && h.tree_size <= MAX_TREE_SIZE
+               && read_bytes(infile, c->payload, h.tree_size) == h.tree_size
+               && table_load(&c->decoder->table, h.tree_size, c->payload)) {
+        ok = search_legacy(c, infile, &h, s);
+        search_end(s);
+        if (!ok) {
+            fprintf(stderr, "Error: truncated input\n");
+        }
+        c->compressed = bytes_read;
+        c->decoder->table.root = NULL;
+    } else {
+        fprintf(stderr, "Error: invalid file header\n");
+        ok = false;
+    }
+    if (!ok && h.magic == MAGIC_BLOCKS) {
+        fprintf(stderr, "Error: corrupt block\n");
+    }
+    free(s);
+    return ok;
+}
@@ -0,0 +1,41 @@
+#ifndef __SEARCH_H__
+#define __SEARCH_H__
+
+#include "codec.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SEARCH_CHUNK   (128 * 1024) // Decoded bytes scanned at a time, sized for L2.
+#define SEARCH_LINE    4096 // Bytes of a matching line reported, longer ones are cut.
+#define SEARCH_PATTERN 256 // Longest pattern.
+#define SEARCH_TASK    (4 * MAX_BLOCK) // Uncompressed bytes per parallel task.
+
+// Called for each matching line in order, offset is its uncompressed start
+typedef void (*SearchReport)(void *arg, uint64_t offset, const uint8_t *line, uint32_t len);
+
+// Line matcher fed the decoded data in order, a chunk at a time
+typedef struct Search {
+    const uint8_t *pattern;
+    uint32_t plen;
+    int32_t anchor; // Pattern byte memchr() looks for, -1 until picked.
+    uint64_t offset; // Uncompressed offset of the next chunk.
+    uint64_t line_start; // Uncompressed offset of the current line.
+    bool matched; // The current line contains the pattern.
+    uint8_t line[SEARCH_LINE]; // Its first bytes.
+    uint32_t nline;
+    uint8_t tail[SEARCH_PATTERN]; // Its last plen - 1 bytes, for matches across chunks.
+    uint32_t ntail;
+    SearchReport report;
+    void *arg;
+} Search;
+
+void search_begin(Search *s, const uint8_t *pattern, uint32_t plen, uint64_t offset, SearchReport report, void *arg);
+
+void search_chunk(Search *s, const uint8_t *buf, uint64_t n);
+
+void search_end(Search *s);
+
+bool search_file(Codec *c, int infile, const uint8_t *pattern, uint32_t plen, SearchReport report, void *arg);
+
+#endif
@@ -0,0 +1,64 @@
+#include "table.h"
+
+#include "huffman.h"
+#include "node.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+DecodeTable *table_create(Node *root) {
+    DecodeTable *t = (DecodeTable *) malloc(sizeof(DecodeTable));
+    if (t) {
+        table_build(t, root);
+    }
+    return t;
+}
+
+// Rebuild an existing table for a new tree
+void table_build(DecodeTable *t, Node *root) {
+    t->root = root;
+    // Walk the tree with every possible window, collecting whole symbols
+    for (uint32_t w = 0; w < (1 << TABLE_BITS); w++) {
+        TableEntry *e = &t->entries[w];
+        e->count = 0;
+        e->bits = 0;
+        Node *curr = root;
+        for (uint32_t i = 0; i < TABLE_BITS && e->count < TABLE_SYMS; i++) {
+            curr = ((w >> i) & 0x1) ? curr->right : curr->left;
+            if (!curr->left && !curr->right) { // Found leaf
+                e->syms[e->count] = curr->symbol;
+                e->count++;
+                e->bits = i + 1;
+                curr = root;
+            }
+        }
+    }
+}
+
+// Rebuild the tree from an untrusted dump into the table's own nodes.
+// Returns false, with no tree left, if the dump is malformed.
+bool table_load(DecodeTable *t, uint16_t nbytes, const uint8_t *dump) {
+    t->root = rebuild_tree(nbytes, dump, t->nodes);
+    if (!t->root) {
+        return false;
+    }
+    table_build(t, t->root);
+    return true;
+}
+
+void table_delete(DecodeTable **t) {
+    if (*t) {
+        free(*t);
+        *t = NULL;
+    }
+}
+
+// Decodes up to nsyms symbols starting before bit limit, returns the count.
+// Symbols may read past limit up to nbits. Codes longer than the window,
+// and the tail of the stream, fall back to walking the tree.
+uint64_t table_decode(DecodeTable *t, const uint8_t *data, uint64_t nbits, uint64_t *pos,
+    uint64_t limit, uint8_t *out, uint64_t nsyms) {
+    return table_decode_with(peek_window, t, data, nbits, pos, limit, out, nsyms);
+}
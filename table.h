@@ -0,0 +1,72 @@
+#ifndef __TABLE_H__
+#define __TABLE_H__
+
+#include "huffman.h"
+#include "node.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TABLE_BITS 12 // Bits peeked per lookup.
+#define TABLE_SYMS 4 // Maximum symbols emitted per lookup.
+
+typedef struct TableEntry {
+    uint8_t count; // Complete symbols in the window, 0 if the code is longer.
+    uint8_t bits; // Bits consumed by those symbols.
+    uint8_t syms[TABLE_SYMS];
+} TableEntry;
+
+typedef struct DecodeTable {
+    Node *root;
+    TableEntry entries[1 << TABLE_BITS];
+    Node nodes[MAX_NODES]; // Tree storage for table_load().
+} DecodeTable;
+
+DecodeTable *table_create(Node *root);
+
+void table_build(DecodeTable *t, Node *root);
+
+bool table_load(DecodeTable *t, uint16_t nbytes, const uint8_t *dump);
+
+void table_delete(DecodeTable **t);
+
+uint64_t table_decode(DecodeTable *t, const uint8_t *data, uint64_t nbits, uint64_t *pos,
+    uint64_t limit, uint8_t *out, uint64_t nsyms);
+
+// Peek TABLE_BITS bits at pos, bits past the end of data read as zero
+static inline uint32_t peek_window(const uint8_t *data, uint64_t nbits, uint64_t pos) {
+    uint64_t byte = pos / 8;
+    uint64_t nbytes = (nbits + 7) / 8;
+    uint64_t word = 0;
+    if (byte + 8 <= nbytes) {
+        memcpy(&word, &data[byte], 8); // Stream is little-endian bit order
+    } else {
+        for (uint64_t i = byte; i < nbytes; i++) {
+            word |= (uint64_t) data[i] << (8 * (i - byte));
+        }
+    }
+    return (word >> (pos % 8)) & ((1 << TABLE_BITS) - 1);
+}
+
+// Shared by the dispatched decode kernels, each passes its own peek
+static inline __attribute__((always_inline)) uint64_t table_decode_with(
+    uint32_t (*peek)(const uint8_t *, uint64_t, uint64_t), DecodeTable *t, const uint8_t *data,
+    uint64_t nbits, uint64_t *pos, uint64_t limit, uint8_t *out, uint64_t nsyms) {
+    uint64_t n = 0;
+    while (*pos < limit && n < nsyms) {
+        TableEntry *e = &t->entries[peek(data, nbits, *pos)];
+        if (e->count && nsyms - n >= TABLE_SYMS && *pos + e->bits <= nbits) {
+            memcpy(&out[n], e->syms, TABLE_SYMS);
+            n += e->count;
+            *pos += e->bits;
+        } else if (decode_symbol(t->root, data, nbits, pos, &out[n])) {
+            n++;
+        } else {
+            break; // Stream ended mid-symbol
+        }
+    }
+    return n;
+}
+
+#endif
@@ -0,0 +1,221 @@
+#include "tans.h"
+
+#include "defines.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Position step used to spread symbols over the table, odd so every slot is hit
+#define TANS_STEP ((TANS_SIZE >> 1) + (TANS_SIZE >> 3) + 3)
+
+static inline uint32_t high_bit(uint32_t x) {
+    return 31 - __builtin_clz(x);
+}
+
+// Scale counts to sum to TANS_SIZE, every present symbol keeping at least 1
+void tans_normalize(uint64_t hist[static ALPHABET], uint64_t n, uint16_t freq[static ALPHABET]) {
+    int32_t total = 0;
+    int largest = 0;
+    for (int i = 0; i < ALPHABET; i++) {
+        freq[i] = 0;
+        if (hist[i]) {
+            uint64_t f = (hist[i] * TANS_SIZE + n / 2) / n;
+            freq[i] = f ? f : 1;
+            total += freq[i];
+            largest = freq[i] > freq[largest] ? i : largest;
+        }
+    }
+    // Give or take the rounding error from the largest counts
+    while (total != TANS_SIZE) {
+        if (total < TANS_SIZE) {
+            freq[largest] += TANS_SIZE - total;
+            total = TANS_SIZE;
+            continue;
+        }
+        for (int i = 0; i < ALPHABET; i++) {
+            largest = freq[i] > freq[largest] ? i : largest;
+        }
+        uint32_t take = total - TANS_SIZE < freq[largest] / 4 + 1 ? total - TANS_SIZE : freq[largest] / 4 + 1;
+        freq[largest] -= take;
+        total -= take;
+    }
+}
+
+// Estimated bits for the codes, excluding the table
+double tans_cost(uint64_t hist[static ALPHABET], uint16_t freq[static ALPHABET]) {
+    double bits = 2 * TANS_LOG;
+    for (int i = 0; i < ALPHABET; i++) {
+        if (hist[i]) {
+            bits += hist[i] * (TANS_LOG - log2((double) freq[i]));
+        }
+    }
+    return bits;
+}
+
+// Count of symbols, then a symbol byte and 16-bit frequency for each
+uint32_t tans_write_table(uint16_t freq[static ALPHABET], uint8_t *buf) {
+    uint32_t idx = 1;
+    for (int i = 0; i < ALPHABET; i++) {
+        if (freq[i]) {
+            buf[idx] = i;
+            memcpy(&buf[idx + 1], &freq[i], 2);
+            idx += 3;
+        }
+    }
+    buf[0] = (idx - 1) / 3; // 256 symbols wraps to 0
+    return idx;
+}
+
+bool tans_read_table(const uint8_t *buf, uint32_t size, uint16_t freq[static ALPHABET]) {
+    memset(freq, 0, ALPHABET * sizeof(uint16_t));
+    uint32_t count = buf[0] ? buf[0] : ALPHABET;
+    if (size != 1 + 3 * count) {
+        return false;
+    }
+    uint32_t total = 0;
+    for (uint32_t k = 0; k < count; k++) {
+        uint8_t sym = buf[1 + 3 * k];
+        if (freq[sym]) {
+            return false; // Repeated symbol
+        }
+        memcpy(&freq[sym], &buf[2 + 3 * k], 2);
+        total += freq[sym];
+    }
+    return total == TANS_SIZE;
+}
+
+static void spread(uint16_t freq[static ALPHABET], uint8_t syms[static TANS_SIZE]) {
+    uint32_t pos = 0;
+    for (int i = 0; i < ALPHABET; i++) {
+        for (uint32_t k = 0; k < freq[i]; k++) {
+            syms[pos] = i;
+            pos = (pos + TANS_STEP) & (TANS_SIZE - 1);
+        }
+    }
+}
+
+// Codes n symbols into out (zeroed, 8 bytes of slack), returns bits written
+// or 0 if out of memory.
+// Even and odd symbols use separate states so the decoder has two
+// independent dependency chains. Symbols are coded last to first, so each
+// step's bits are collected and written in reverse to let the decoder read
+// forward.
+uint64_t tans_encode(const uint8_t *in, uint32_t n, uint16_t freq[static ALPHABET], uint8_t *out) {
+    uint8_t syms[TANS_SIZE];
+    spread(freq, syms);
+    uint16_t start[ALPHABET];
+    uint16_t next[ALPHABET];
+    uint32_t sum = 0;
+    for (int i = 0; i < ALPHABET; i++) {
+        start[i] = sum;
+        next[i] = freq[i];
+        sum += freq[i];
+    }
+    uint16_t states[TANS_SIZE];
+    for (uint32_t i = 0; i < TANS_SIZE; i++) {
+        uint8_t s = syms[i];
+        states[start[s] + next[s] - freq[s]] = TANS_SIZE + i;
+        next[s]++;
+    }
+
+    uint16_t *chunks = (uint16_t *) malloc((n + 1) * sizeof(uint16_t)); // value | bits << 12
+    if (!chunks) {
+        return 0;
+    }
+    uint32_t x[2] = { TANS_SIZE, TANS_SIZE };
+    for (uint32_t i = n; i > 0; i--) {
+        uint8_t s = in[i - 1];
+        uint32_t *state = &x[(i - 1) & 1];
+        uint32_t k = TANS_LOG - high_bit(freq[s]);
+        if ((*state >> k) < freq[s]) {
+            k--;
+        }
+        chunks[i - 1] = (*state & ((1 << k) - 1)) | (k << 12);
+        *state = states[start[s] + (*state >> k) - freq[s]];
+    }
+
+    uint64_t pos = 0;
+    uint64_t word;
+    memcpy(&word, out, 8);
+    word |= (x[0] - TANS_SIZE) | ((uint64_t) (x[1] - TANS_SIZE) << TANS_LOG);
+    memcpy(out, &word, 8);
+    pos += 2 * TANS_LOG;
+    for (uint32_t i = 0; i < n; i++) {
+        memcpy(&word, &out[pos / 8], 8);
+        word |= (uint64_t) (chunks[i] & 0xfff) << (pos % 8);
+        memcpy(&out[pos / 8], &word, 8);
+        pos += chunks[i] >> 12;
+    }
+    free(chunks);
+    return pos;
+}
+
+void tans_build(uint16_t freq[static ALPHABET], TansEntry table[static TANS_SIZE]) {
+    uint8_t syms[TANS_SIZE];
+    spread(freq, syms);
+    uint32_t next[ALPHABET];
+    for (int i = 0; i < ALPHABET; i++) {
+        next[i] = freq[i];
+    }
+    for (uint32_t i = 0; i < TANS_SIZE; i++) {
+        uint8_t s = syms[i];
+        uint32_t x = next[s]++;
+        uint32_t k = TANS_LOG - high_bit(x);
+        table[i].sym = s;
+        table[i].bits = k;
+        table[i].base = (x << k) - TANS_SIZE;
+    }
+}
+
+// Read nbits bits at pos, bits past the end read as zero
+static inline uint32_t tans_bits(const uint8_t *data, uint64_t nbytes, uint64_t pos, uint32_t nbits) {
+    uint64_t byte = pos / 8;
+    uint64_t word = 0;
+    if (byte + 8 <= nbytes) {
+        memcpy(&word, &data[byte], 8);
+    } else {
+        for (uint64_t i = byte; i < nbytes; i++) {
+            word |= (uint64_t) data[i] << (8 * (i - byte));
+        }
+    }
+    return (word >> (pos % 8)) & ((1u << nbits) - 1);
+}
+
+// Decodes n symbols, returns false if they need more than nbits bits
+bool tans_decode(TansEntry table[static TANS_SIZE], const uint8_t *data, uint64_t nbits, uint8_t *out,
+    uint32_t n) {
+    uint64_t nbytes = (nbits + 7) / 8;
+    uint64_t pos = 2 * TANS_LOG;
+    uint32_t x0 = tans_bits(data, nbytes, 0, TANS_LOG);
+    uint32_t x1 = tans_bits(data, nbytes, TANS_LOG, TANS_LOG);
+    uint32_t i = 0;
+    // Whole-word loads while at least 8 bytes remain, four steps of at most
+    // 11 bits each fit in the 56 bits left after aligning
+    while (i + 4 <= n && pos / 8 + 8 <= nbytes) {
+        uint64_t word;
+        memcpy(&word, &data[pos / 8], 8);
+        word >>= pos % 8;
+        for (int k = 0; k < 2; k++, i += 2) {
+            TansEntry a = table[x0];
+            TansEntry b = table[x1];
+            out[i] = a.sym;
+            out[i + 1] = b.sym;
+            x0 = a.base + (word & ((1u << a.bits) - 1));
+            word >>= a.bits;
+            x1 = b.base + (word & ((1u << b.bits) - 1));
+            word >>= b.bits;
+            pos += a.bits + b.bits;
+        }
+    }
+    for (; i < n; i++) {
+        uint32_t *x = (i & 1) ? &x1 : &x0;
+        TansEntry e = table[*x];
+        out[i] = e.sym;
+        *x = e.base + tans_bits(data, nbytes, pos, e.bits);
+        pos += e.bits;
+    }
+    return pos <= nbits;
+}
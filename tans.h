@@ -0,0 +1,33 @@
+#ifndef __TANS_H__
+#define __TANS_H__
+
+#include "defines.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TANS_LOG  11 // log2 of the state table size.
+#define TANS_SIZE (1 << TANS_LOG)
+
+typedef struct TansEntry {
+    uint8_t sym;
+    uint8_t bits; // Bits read to reach the next state.
+    uint16_t base; // Next state before adding those bits.
+} TansEntry;
+
+void tans_normalize(uint64_t hist[static ALPHABET], uint64_t n, uint16_t freq[static ALPHABET]);
+
+double tans_cost(uint64_t hist[static ALPHABET], uint16_t freq[static ALPHABET]);
+
+uint32_t tans_write_table(uint16_t freq[static ALPHABET], uint8_t *buf);
+
+bool tans_read_table(const uint8_t *buf, uint32_t size, uint16_t freq[static ALPHABET]);
+
+uint64_t tans_encode(const uint8_t *in, uint32_t n, uint16_t freq[static ALPHABET], uint8_t *out);
+
+void tans_build(uint16_t freq[static ALPHABET], TansEntry table[static TANS_SIZE]);
+
+bool tans_decode(TansEntry table[static TANS_SIZE], const uint8_t *data, uint64_t nbits, uint8_t *out,
+    uint32_t n);
+
+#endif
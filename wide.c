@@ -0,0 +1,397 @@
+#include "wide.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A used symbol and its count, sorted to build code lengths
+typedef struct WideLeaf {
+    uint32_t count;
+    uint16_t sym;
+} WideLeaf;
+
+WideCoder *wide_create(void) {
+    WideCoder *w = (WideCoder *) malloc(sizeof(WideCoder));
+    if (w) {
+        w->nused = 0;
+        w->hist = (uint32_t *) calloc(WIDE_ALPHABET, sizeof(uint32_t));
+        w->used = (uint16_t *) malloc(WIDE_ALPHABET * sizeof(uint16_t));
+        w->len = (uint8_t *) calloc(WIDE_ALPHABET, sizeof(uint8_t));
+        w->code = (uint32_t *) malloc(WIDE_ALPHABET * sizeof(uint32_t));
+        if (!w->hist || !w->used || !w->len || !w->code) {
+            free(w->hist);
+            free(w->used);
+            free(w->len);
+            free(w->code);
+            free(w);
+            w = NULL;
+        }
+    }
+    return w;
+}
+
+void wide_delete(WideCoder **w) {
+    if (*w) {
+        free((*w)->hist);
+        free((*w)->used);
+        free((*w)->len);
+        free((*w)->code);
+        free(*w);
+        *w = NULL;
+    }
+}
+
+// Little-endian pairs of bytes, an odd last byte is a symbol on its own
+static inline uint16_t wide_symbol(const uint8_t *buf, uint32_t n, uint32_t i) {
+    return 2 * i + 1 < n ? buf[2 * i] | buf[2 * i + 1] << 8 : buf[2 * i];
+}
+
+static int symbol_order(const void *a, const void *b) {
+    return *(const uint16_t *) a - *(const uint16_t *) b;
+}
+
+static int leaf_order(const void *a, const void *b) {
+    const WideLeaf *x = (const WideLeaf *) a;
+    const WideLeaf *y = (const WideLeaf *) b;
+    if (x->count != y->count) {
+        return x->count < y->count ? -1 : 1;
+    }
+    return x->sym - y->sym;
+}
+
+// Sparse histogram: only symbols seen in the previous block are cleared,
+// and the used list is what later passes walk
+static void wide_count(WideCoder *w, const uint8_t *buf, uint32_t n) {
+    for (uint32_t k = 0; k < w->nused; k++) {
+        w->hist[w->used[k]] = 0;
+        w->len[w->used[k]] = 0;
+    }
+    w->nused = 0;
+    uint32_t nsyms = (n + 1) / 2;
+    for (uint32_t i = 0; i < nsyms; i++) {
+        uint16_t s = wide_symbol(buf, n, i);
+        if (!w->hist[s]++) {
+            w->used[w->nused++] = s;
+        }
+    }
+    qsort(w->used, w->nused, sizeof(uint16_t), symbol_order);
+}
+
+// Huffman code lengths for the used symbols, limited to WIDE_MAX_LEN by
+// lengthening the least frequent codes until the Kraft sum fits, then
+// spending any slack on the most frequent ones. Returns false if out of
+// memory.
+static bool wide_lengths(WideCoder *w) {
+    uint32_t n = w->nused;
+    if (n == 1) {
+        w->len[w->used[0]] = 1;
+        return true;
+    }
+    WideLeaf *leaf = (WideLeaf *) malloc(n * sizeof(WideLeaf));
+    uint64_t *weight = (uint64_t *) calloc(2 * n - 1, sizeof(uint64_t));
+    uint32_t *parent = (uint32_t *) malloc((2 * n - 1) * sizeof(uint32_t));
+    if (!leaf || !weight || !parent) {
+        free(leaf);
+        free(weight);
+        free(parent);
+        return false;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        leaf[i] = (WideLeaf) { w->hist[w->used[i]], w->used[i] };
+    }
+    qsort(leaf, n, sizeof(WideLeaf), leaf_order);
+    for (uint32_t i = 0; i < n; i++) {
+        weight[i] = leaf[i].count;
+    }
+
+    // Sorted leaves and internal nodes form two queues, both increasing
+    uint32_t l = 0;
+    uint32_t m = n;
+    for (uint32_t next = n; next < 2 * n - 1; next++) {
+        for (int k = 0; k < 2; k++) {
+            uint32_t pick = l < n && (m == next || weight[l] <= weight[m]) ? l++ : m++;
+            parent[pick] = next;
+            weight[next] += weight[pick];
+        }
+    }
+    // Parents come after their children, so depths replace parents in place
+    parent[2 * n - 2] = 0;
+    for (uint32_t x = 2 * n - 2; x-- > 0;) {
+        parent[x] = parent[parent[x]] + 1;
+    }
+
+    const uint64_t full = 1 << WIDE_MAX_LEN;
+    uint64_t kraft = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint8_t len = parent[i] < WIDE_MAX_LEN ? parent[i] : WIDE_MAX_LEN;
+        w->len[leaf[i].sym] = len;
+        kraft += full >> len;
+    }
+    for (uint32_t i = 0; i < n && kraft > full; i++) {
+        uint8_t *len = &w->len[leaf[i].sym];
+        while (*len < WIDE_MAX_LEN && kraft > full) {
+            (*len)++;
+            kraft -= full >> *len;
+        }
+    }
+    for (uint32_t i = n; i-- > 0;) {
+        uint8_t *len = &w->len[leaf[i].sym];
+        while (*len > 1 && kraft + (full >> *len) <= full) {
+            kraft += full >> *len;
+            (*len)--;
+        }
+    }
+    free(leaf);
+    free(weight);
+    free(parent);
+    return true;
+}
+
+static inline uint32_t reverse_bits(uint32_t code, uint32_t len) {
+    uint32_t r = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        r = (r << 1) | ((code >> i) & 1);
+    }
+    return r;
+}
+
+// Canonical codes in (length, symbol) order, bit-reversed since the
+// stream is written LSB first
+static void wide_codes(WideCoder *w) {
+    uint32_t count[WIDE_MAX_LEN + 1] = { 0 };
+    uint32_t next[WIDE_MAX_LEN + 1];
+    for (uint32_t k = 0; k < w->nused; k++) {
+        count[w->len[w->used[k]]]++;
+    }
+    uint32_t code = 0;
+    for (int l = 1; l <= WIDE_MAX_LEN; l++) {
+        code = (code + count[l - 1]) << 1;
+        next[l] = code;
+    }
+    for (uint32_t k = 0; k < w->nused; k++) {
+        uint16_t s = w->used[k];
+        w->code[s] = reverse_bits(next[w->len[s]]++, w->len[s]);
+    }
+}
+
+static inline uint32_t varint_size(uint32_t v) {
+    return v < (1 << 7) ? 1 : v < (1 << 14) ? 2 : 3;
+}
+
+static uint32_t put_varint(uint8_t *out, uint32_t pos, uint32_t v) {
+    while (v >= 0x80) {
+        out[pos++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    out[pos++] = v;
+    return pos;
+}
+
+static bool get_varint(const uint8_t *buf, uint32_t size, uint32_t *pos, uint32_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 21; shift += 7) {
+        if (*pos >= size) {
+            return false;
+        }
+        uint8_t b = buf[(*pos)++];
+        *v |= (uint32_t) (b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Counts the block's symbols and builds their codes. Sets the bits the
+// codes take and the size of the table written by wide_write_table().
+// Returns false if out of memory.
+bool wide_plan(WideCoder *w, const uint8_t *buf, uint32_t n, uint64_t *bits, uint32_t *table_size) {
+    wide_count(w, buf, n);
+    if (!wide_lengths(w)) {
+        return false;
+    }
+    wide_codes(w);
+    *bits = 0;
+    uint32_t size = varint_size(w->nused - 1);
+    int32_t prev = -1;
+    for (uint32_t k = 0; k < w->nused; k++) {
+        uint16_t s = w->used[k];
+        *bits += (uint64_t) w->hist[s] * w->len[s];
+        size += varint_size(s - prev - 1) + 1;
+        prev = s;
+    }
+    *table_size = size;
+    return true;
+}
+
+// Symbol count less one, then for each symbol ascending the gap since the
+// previous one and its code length. Dense runs of values cost two bytes a
+// symbol, however large the alphabet.
+uint32_t wide_write_table(WideCoder *w, uint8_t *out) {
+    uint32_t pos = put_varint(out, 0, w->nused - 1);
+    int32_t prev = -1;
+    for (uint32_t k = 0; k < w->nused; k++) {
+        uint16_t s = w->used[k];
+        pos = put_varint(out, pos, s - prev - 1);
+        out[pos++] = w->len[s];
+        prev = s;
+    }
+    return pos;
+}
+
+// Codes the block into out (8 bytes of slack), returns bits written
+uint64_t wide_encode(WideCoder *w, const uint8_t *buf, uint32_t n, uint8_t *out) {
+    uint64_t acc = 0;
+    uint32_t fill = 0;
+    uint64_t bytes = 0;
+    uint32_t nsyms = (n + 1) / 2;
+    for (uint32_t i = 0; i < nsyms; i++) {
+        uint16_t s = wide_symbol(buf, n, i);
+        acc |= (uint64_t) w->code[s] << fill;
+        fill += w->len[s];
+        if (fill >= 32) {
+            memcpy(&out[bytes], &acc, 4); // Stream is little-endian bit order
+            bytes += 4;
+            acc >>= 32;
+            fill -= 32;
+        }
+    }
+    memcpy(&out[bytes], &acc, 8);
+    return bytes * 8 + fill;
+}
+
+// Parses and checks an untrusted table: symbols strictly ascending,
+// lengths in range and a Kraft sum of at most one, so every lookup stays
+// inside the table. Then fills the primary lookup for short codes.
+bool wide_read_table(WideTable *t, const uint8_t *buf, uint32_t size) {
+    uint32_t pos = 0;
+    uint32_t nused;
+    if (!get_varint(buf, size, &pos, &nused) || nused >= WIDE_ALPHABET) {
+        return false;
+    }
+    nused++;
+    uint32_t start = pos;
+    memset(t->count, 0, sizeof(t->count));
+    int32_t prev = -1;
+    for (uint32_t k = 0; k < nused; k++) {
+        uint32_t gap;
+        if (!get_varint(buf, size, &pos, &gap) || prev + 1 + gap >= WIDE_ALPHABET || pos >= size
+            || buf[pos] == 0 || buf[pos] > WIDE_MAX_LEN) {
+            return false;
+        }
+        prev += 1 + gap;
+        t->count[buf[pos++]]++;
+    }
+    uint64_t kraft = 0;
+    for (int l = 1; l <= WIDE_MAX_LEN; l++) {
+        kraft += (uint64_t) t->count[l] << (WIDE_MAX_LEN - l);
+    }
+    if (pos != size || kraft > (1 << WIDE_MAX_LEN)) {
+        return false;
+    }
+
+    // Counting sort into canonical order, then the same codes as the encoder
+    uint32_t offset[WIDE_MAX_LEN + 1];
+    uint32_t next[WIDE_MAX_LEN + 1];
+    uint32_t code = 0;
+    offset[0] = 0;
+    next[0] = 0;
+    for (int l = 1; l <= WIDE_MAX_LEN; l++) {
+        offset[l] = offset[l - 1] + t->count[l - 1];
+        code = (code + t->count[l - 1]) << 1;
+        next[l] = code;
+    }
+    memcpy(t->first, next, sizeof(next));
+    memcpy(t->offset, offset, sizeof(offset));
+    memset(t->entries, 0, sizeof(t->entries));
+    pos = start;
+    prev = -1;
+    for (uint32_t k = 0; k < nused; k++) {
+        uint32_t gap;
+        get_varint(buf, size, &pos, &gap);
+        prev += 1 + gap;
+        uint8_t len = buf[pos++];
+        t->syms[offset[len]++] = prev;
+        if (len <= WIDE_TABLE_BITS) {
+            uint32_t r = reverse_bits(next[len], len);
+            for (uint32_t i = r; i < (1 << WIDE_TABLE_BITS); i += 1 << len) {
+                t->entries[i] = (uint32_t) prev << 5 | len;
+            }
+        }
+        next[len]++;
+    }
+    return true;
+}
+
+// Codes longer than the table continue from the window's bits, one more
+// bit per length until the code falls in that length's canonical range.
+// word holds at least WIDE_MAX_LEN bits. Returns the length, 0 if none.
+static inline uint32_t wide_long(WideTable *t, uint64_t word, uint16_t *sym) {
+    uint32_t code = reverse_bits(word, WIDE_TABLE_BITS);
+    for (int l = WIDE_TABLE_BITS + 1; l <= WIDE_MAX_LEN; l++) {
+        code = (code << 1) | ((word >> (l - 1)) & 0x1);
+        if (code - t->first[l] < t->count[l]) {
+            *sym = t->syms[t->offset[l] + code - t->first[l]];
+            return l;
+        }
+    }
+    return 0;
+}
+
+// The 64 bits at pos, bits past the end of data read as zero
+static inline uint64_t wide_peek(const uint8_t *data, uint64_t nbytes, uint64_t pos) {
+    uint64_t byte = pos / 8;
+    uint64_t word = 0;
+    if (byte + 8 <= nbytes) {
+        memcpy(&word, &data[byte], 8);
+    } else {
+        for (uint64_t i = byte; i < nbytes; i++) {
+            word |= (uint64_t) data[i] << (8 * (i - byte));
+        }
+    }
+    return word >> (pos % 8);
+}
+
+// Decodes n bytes. Whole-word loads while at least 8 bytes remain, two
+// lookups of at most WIDE_MAX_LEN bits each fit in the 56 bits left after
+// aligning, four if the codes are short.
+bool wide_decode(WideTable *t, const uint8_t *data, uint64_t nbits, uint8_t *out, uint32_t n) {
+    uint64_t nbytes = (nbits + 7) / 8;
+    uint64_t pos = 0;
+    uint32_t pairs = n / 2;
+    uint32_t i = 0;
+    while (i + 4 <= pairs && pos / 8 + 8 <= nbytes) {
+        uint64_t word = wide_peek(data, nbytes, pos);
+        uint32_t used = 0;
+        for (int k = 0; k < 4 && used + WIDE_MAX_LEN <= 56; k++, i++) {
+            uint32_t e = t->entries[word & ((1 << WIDE_TABLE_BITS) - 1)];
+            uint16_t sym = e >> 5;
+            uint32_t len = e & 31;
+            if (!e && !(len = wide_long(t, word, &sym))) {
+                return false;
+            }
+            out[2 * i] = sym;
+            out[2 * i + 1] = sym >> 8;
+            word >>= len;
+            used += len;
+        }
+        pos += used;
+    }
+    uint32_t nsyms = (n + 1) / 2;
+    for (; i < nsyms; i++) {
+        uint64_t word = wide_peek(data, nbytes, pos);
+        uint32_t e = t->entries[word & ((1 << WIDE_TABLE_BITS) - 1)];
+        uint16_t sym = e >> 5;
+        uint32_t len = e & 31;
+        if ((!e && !(len = wide_long(t, word, &sym))) || pos + len > nbits) {
+            return false;
+        }
+        out[2 * i] = sym;
+        if (2 * i + 1 < n) {
+            out[2 * i + 1] = sym >> 8;
+        }
+        pos += len;
+    }
+    return true;
+}
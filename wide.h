@@ -0,0 +1,43 @@
+#ifndef __WIDE_H__
+#define __WIDE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WIDE_ALPHABET   65536 // 16-bit symbols.
+#define WIDE_MAX_LEN    20 // Longest code, bounds the slow decode path.
+#define WIDE_TABLE_BITS 11 // Bits peeked per lookup, an 8KB table.
+
+// Encoder state for 16-bit symbols, reused between blocks
+typedef struct WideCoder {
+    uint32_t *hist; // Count per symbol, only used ones are non-zero.
+    uint16_t *used; // Symbols present in the block, ascending.
+    uint32_t nused;
+    uint8_t *len; // Code length per symbol.
+    uint32_t *code; // Bit-reversed canonical code per symbol.
+} WideCoder;
+
+// Decode table, only the primary lookup is touched for short codes
+typedef struct WideTable {
+    uint32_t entries[1 << WIDE_TABLE_BITS]; // Symbol << 5 | length, 0 if longer.
+    uint32_t count[WIDE_MAX_LEN + 1]; // Codes of each length.
+    uint32_t first[WIDE_MAX_LEN + 1]; // First canonical code of each length.
+    uint32_t offset[WIDE_MAX_LEN + 1]; // Its index in syms.
+    uint16_t syms[WIDE_ALPHABET]; // Symbols in canonical order.
+} WideTable;
+
+WideCoder *wide_create(void);
+
+void wide_delete(WideCoder **w);
+
+bool wide_plan(WideCoder *w, const uint8_t *buf, uint32_t n, uint64_t *bits, uint32_t *table_size);
+
+uint32_t wide_write_table(WideCoder *w, uint8_t *out);
+
+uint64_t wide_encode(WideCoder *w, const uint8_t *buf, uint32_t n, uint8_t *out);
+
+bool wide_read_table(WideTable *t, const uint8_t *buf, uint32_t size);
+
+bool wide_decode(WideTable *t, const uint8_t *data, uint64_t nbits, uint8_t *out, uint32_t n);
+
+#endif